@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,17 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// The buffers are hashed by (dev, blockno) into NBUCKET buckets, each
+// with a lock of its own, so a block that is cached is found, and
+// released, under the lock of its bucket alone. Instead of keeping an
+// LRU list, which every brelse() would have to update under one lock,
+// a miss recycles a buffer by the clock algorithm: a hand sweeps
+// bcache.buf[], and takes the first unused buffer that has not been
+// released since the hand last passed it (brelse() sets b->used, the
+// hand clears it). The hand is advanced atomically, so misses sweep
+// side by side; each buffer is examined under the lock of its bucket,
+// and no one ever holds more than one bucket lock.
 
 
 #include "types.h"
@@ -23,69 +34,141 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;   // Buffers of the bucket, through next.
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+// Device of the buffers that hold no block.
+#define NODEV (~0U)
+
+struct {
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  uint hand;     // Next buffer for the clock to look at, mod NBUF.
 } bcache;
 
+static struct bucket*
+bucketof(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Start with all buffers in bucket 0, holding no block.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->dev = NODEV;
+    b->bucket = 0;
+    b->next = bcache.bucket[0].head;
+    bcache.bucket[0].head = b;
   }
 }
 
+// The buffer of the block in bk, or 0.
+// Caller must hold bk->lock.
+static struct buf*
+lookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Take an unused buffer out of its bucket, for bget(): the first
+// one the clock hand finds with b->used clear, which it clears on the
+// buffers it passes. Returns it with a reference, in no bucket.
+static struct buf*
+reclaim(void)
+{
+  struct bucket *bk;
+  struct buf *b, **pp;
+  int i;
+
+  // Two sweeps find one, unless they are all in use.
+  for(int n = 0; n < 3*NBUF; n++){
+    i = __atomic_fetch_add(&bcache.hand, 1, __ATOMIC_RELAXED) % NBUF;
+    b = &bcache.buf[i];
+    // A first look without the lock, to skip the busy ones.
+    i = __atomic_load_n(&b->bucket, __ATOMIC_RELAXED);
+    if(i < 0 || __atomic_load_n(&b->refcnt, __ATOMIC_RELAXED) != 0)
+      continue;
+    bk = &bcache.bucket[i];
+    acquire(&bk->lock);
+    // It may have moved meanwhile.
+    if(b->bucket != i || b->refcnt != 0){
+      release(&bk->lock);
+      continue;
+    }
+    if(b->used){
+      b->used = 0;
+      release(&bk->lock);
+      continue;
+    }
+    for(pp = &bk->head; *pp != b; pp = &(*pp)->next)
+      ;
+    *pp = b->next;
+    __atomic_store_n(&b->bucket, -1, __ATOMIC_RELAXED);
+    b->refcnt = 1;
+    release(&bk->lock);
+    return b;
+  }
+  panic("bget: no buffers");
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct bucket *bk = bucketof(dev, blockno);
+  struct buf *b, *victim;
 
-  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = lookup(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
-
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  release(&bk->lock);
+
+  // Not cached; recycle a buffer for it.
+  victim = reclaim();
+  acquire(&bk->lock);
+  if((b = lookup(bk, dev, blockno)) != 0){
+    // Another miss brought it in meanwhile: the victim
+    // joins the bucket unused, holding no block.
+    b->refcnt++;
+    victim->dev = NODEV;
+    victim->refcnt = 0;
+  } else {
+    b = victim;
+    b->dev = dev;
+    b->blockno = blockno;
   }
-  panic("bget: no buffers");
+  victim->valid = 0;
+  victim->used = 0;
+  victim->next = bk->head;
+  bk->head = victim;
+  __atomic_store_n(&victim->bucket, bk - bcache.bucket, __ATOMIC_RELAXED);
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -112,42 +195,44 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Mark it used, for the clock hand of reclaim().
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // Our reference keeps it in its bucket.
+  bk = bucketof(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->used = 1;
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  if (b->refcnt == 0)
+    b->used = 1;
+  release(&bk->lock);
 }
-
-
@@ -5,8 +5,9 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  int bucket;       // index of its bucket, -1 while in none
+  int used;         // released since the clock hand last passed
+  struct buf *next; // hash bucket list
   uchar data[BSIZE];
 };
 
@@ -0,0 +1,16 @@
+#ifndef CPUSTAT_H_
+#define CPUSTAT_H_
+
+#include "param.h"
+#include "types.h"
+
+struct cpustat {
+  int online[NCPU];
+  uint64 idle[NCPU];  // Cycles spent idle, waiting in wfi.
+  uint64 ticks[NCPU]; // Clock ticks taken.
+  uint64 slspin[NCPU];  // Sleep locks got by spinning for them.
+  uint64 slsleep[NCPU]; // Sleeps waiting for a sleep lock.
+  uint64 time;        // Cycles since boot.
+};
+
+#endif
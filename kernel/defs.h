@@ -6,6 +6,7 @@
 
 struct buf;
 struct context;
+struct fdtable;
 struct file;
 struct inode;
 struct pipe;
@@ -15,7 +16,10 @@ struct sleeplock;
 struct stat;
 struct superblock;
 struct cpu;
+struct currency;
 struct rng;
+struct timer;
+struct scstat;
 
 // bio.c
 void            binit(void);
@@ -37,6 +41,10 @@ int             exec(char*, char**);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+struct fdtable* fdtalloc(void);
+struct fdtable* fdtcopy(struct fdtable*);
+struct fdtable* fdtdup(struct fdtable*);
+void            fdtclose(struct fdtable*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
@@ -53,6 +61,8 @@ void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
+void            ilock_shared(struct inode*);
+void            iunlock_shared(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
@@ -85,9 +95,12 @@ void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
 // proc.c
+void            acct(struct proc*, int);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             clone(uint64, uint64, uint64);
+int             join(int);
 void            proc_mapstacks(pagetable_t);
 int             kill(int);
 struct cpu*     mycpu(void);
@@ -97,15 +110,69 @@ void            procinit(void);
 void            cpuinit(struct cpu*);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+int             sched_setattr(int, int, int);
+int             sched_setaffinity(int, uint64);
+int             proc_scstat(int, struct scstat*);
 void            sleep(void*, struct spinlock*);
+int             sleep_until(void*, struct spinlock*, uint64);
 void            userinit(void);
-int             wait(uint64);
+int             wait(uint64, uint64, uint64);
 void            wakeup(void*);
+void            wakeup_one(void*);
+int             wakeup_n(void*, int);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// futex.c
+void            futexinit(void);
+int             futex_wait(uint64, int, int);
+int             futex_wake(uint64, int);
+
+// timer.c
+void            timerinithart(void);
+void            timer_add(struct timer*, uint64, void (*)(void*), void*);
+void            timer_del(struct timer*);
+int             timer_intr(void);
+void            timer_tickcheck(void);
+
+// uring.c
+uint64          uring_setup(void);
+int             uring_enter(int);
+
+// vdso.c
+void            vdsoinit(void);
+void            vdso_tick(uint64);
+extern uint64   vdso_page;
+
+// prof.c
+void            profinit(void);
+void            prof_intr(int, uint64, uint64);
+int             profctl(int);
+
+// sched.c
+void            runqinit(void);
+void            runq_add(struct proc*);
+struct proc*    runq_pick(struct cpu*, struct proc*);
+void            runq_done(struct proc*, uint64);
+void            runq_idle(struct cpu*);
+void            cpu_kick(struct cpu*);
+void            runq_tick(void);
+int             tickets_value(struct proc*);
+void            currency_join(struct proc*, struct currency*);
+void            currency_leave(struct proc*);
+int             currencyof(struct proc*);
+int             setcurrency(int);
+int             mkcurrency(int);
+int             settickets(int);
+void            tickets_lend(struct proc*, int, int);
+void            tickets_reset(struct proc*);
+int             schedctl(int, int);
+void            runq_setprio(struct proc*, int);
+void            runq_setaffinity(struct proc*, uint64);
+extern int      sched_direct;
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
@@ -113,15 +180,23 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initmcslock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// lockstat.c
+void            lockstat_acquire(struct spinlock*, uint64, int, uint64);
+void            lockstat_release(struct spinlock*);
+int             lockstat_read(uint64, int);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            acquiresleep_shared(struct sleeplock*);
+void            releasesleep_shared(struct sleeplock*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -139,12 +214,11 @@ int             argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+uint64          syscall_run(int);
+int             cpu_scstat(int, struct scstat*);
 
 // trap.c
-extern uint     ticks;
-void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
 void            usertrapret(void);
 
 // uart.c
@@ -16,9 +16,8 @@ int exec(char *path, char **argv) {
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  struct uvm uvm;
+  struct uvm *uvm = 0, *olduvm;
   struct proc *p = myproc();
-  memset(&uvm, 0, sizeof(struct uvm));
 
   begin_op();
 
@@ -26,13 +25,13 @@ int exec(char *path, char **argv) {
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilock_shared(ip);
 
   // Check ELF header
   if (readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf)) goto bad;
   if (elf.magic != ELF_MAGIC) goto bad;
 
-  if (uvm_new(&uvm, (uint64)p->trapframe)) goto bad;
+  if ((uvm = uvm_new((uint64)p->trapframe)) == 0) goto bad;
 
   // Load program into memory.
   for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
@@ -45,12 +44,13 @@ int exec(char *path, char **argv) {
     perm |= ph.flags & ELF_PROG_FLAG_READ ? PTE_R : 0;
     perm |= ph.flags & ELF_PROG_FLAG_WRITE ? PTE_W : 0;
     perm |= ph.flags & ELF_PROG_FLAG_EXEC ? PTE_X : 0;
-    if (uvm_map(&uvm, ph.vaddr, ph.memsz, perm, MAP_PRIVATE, ip, ph.off,
+    if (uvm_map(uvm, ph.vaddr, ph.memsz, perm, MAP_PRIVATE, ip, ph.off,
                 ph.filesz) == -1)
       goto bad;
     highest_addr = MAX(highest_addr, ph.vaddr + ph.memsz);
   }
-  iunlockput(ip);
+  iunlock_shared(ip);
+  iput(ip);
   end_op();
   ip = 0;
 
@@ -59,19 +59,19 @@ int exec(char *path, char **argv) {
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
   highest_addr = PGROUNDUP(highest_addr);
-  if (uvm_map(&uvm, highest_addr, 2 * PGSIZE, PTE_R | PTE_W | PTE_X,
+  if (uvm_map(uvm, highest_addr, 2 * PGSIZE, PTE_R | PTE_W | PTE_X,
               MAP_PRIVATE, 0, 0, 0) == -1)
     goto bad;
-  uvm_completemap(&uvm, highest_addr, PTE_R);
-  pgt_clearubit(uvm.pagetable, highest_addr);
+  uvm_completemap(uvm, highest_addr, PTE_R);
+  pgt_clearubit(uvm->pagetable, highest_addr);
   sp = highest_addr + 2 * PGSIZE;
   stackbase = sp - PGSIZE;
 
   // Create a vma representing the heap of size PGSIZE
-  if (uvm_map(&uvm, sp, PGSIZE, PTE_R | PTE_W | PTE_X, MAP_PRIVATE, 0, 0, 0) ==
+  if (uvm_map(uvm, sp, PGSIZE, PTE_R | PTE_W | PTE_X, MAP_PRIVATE, 0, 0, 0) ==
       -1)
     goto bad;
-  uvm.heap = uvm_va2vma(&uvm, sp);
+  uvm->heap = uvm_va2vma(uvm, sp);
 
   // Push argument strings, prepare rest of stack in ustack.
   for (argc = 0; argv[argc]; argc++) {
@@ -79,7 +79,7 @@ int exec(char *path, char **argv) {
     sp -= strlen(argv[argc]) + 1;
     sp -= sp % 16;  // riscv sp must be 16-byte aligned
     if (sp < stackbase) goto bad;
-    if (copyout(&uvm, sp, argv[argc], strlen(argv[argc]) + 1) < 0) goto bad;
+    if (copyout(uvm, sp, argv[argc], strlen(argv[argc]) + 1) < 0) goto bad;
     ustack[argc] = sp;
   }
   ustack[argc] = 0;
@@ -88,7 +88,7 @@ int exec(char *path, char **argv) {
   sp -= (argc + 1) * sizeof(uint64);
   sp -= sp % 16;
   if (sp < stackbase) goto bad;
-  if (copyout(&uvm, sp, (char *)ustack, (argc + 1) * sizeof(uint64)) < 0)
+  if (copyout(uvm, sp, (char *)ustack, (argc + 1) * sizeof(uint64)) < 0)
     goto bad;
 
   // arguments to user main(argc, argv)
@@ -102,17 +102,22 @@ int exec(char *path, char **argv) {
   safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
-  uvm_free(&p->uvm);
+  // Other threads, if any, keep running in the old one.
+  olduvm = p->uvm;
+  uvm_delthread(olduvm, p->tfva);
+  uvm_free(olduvm);
   p->uvm = uvm;
+  p->tfva = TRAPFRAME;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp;          // initial stack pointer
 
   return argc;  // this ends up in a0, the first argument to main(argc, argv)
 
 bad:
-  uvm_free(&uvm);
+  if (uvm) uvm_free(uvm);
   if (ip) {
-    iunlockput(ip);
+    iunlock_shared(ip);
+    iput(ip);
     end_op();
   }
   return -1;
@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "kalloc.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -22,7 +23,11 @@ struct {
 void
 fileinit(void)
 {
-  initlock(&ftable.lock, "ftable");
+  struct file *f;
+
+  initmcslock(&ftable.lock, "ftable");
+  for(f = ftable.file; f < ftable.file + NFILE; f++)
+    initsleeplock(&f->readlock, "file");
 }
 
 // Allocate a file structure.
@@ -82,6 +87,67 @@ fileclose(struct file *f)
   }
 }
 
+// Allocate an empty table of open files.
+struct fdtable*
+fdtalloc(void)
+{
+  struct fdtable *fdt;
+
+  if((fdt = (struct fdtable*)kalloc()) == 0)
+    return 0;
+  memset(fdt, 0, sizeof(*fdt));
+  initlock(&fdt->lock, "fdtable");
+  fdt->ref = 1;
+  return fdt;
+}
+
+// Allocate a copy of fdt, for a child process.
+struct fdtable*
+fdtcopy(struct fdtable *fdt)
+{
+  struct fdtable *nfdt;
+
+  if((nfdt = fdtalloc()) == 0)
+    return 0;
+  acquire(&fdt->lock);
+  for(int fd = 0; fd < NOFILE; fd++)
+    if(fdt->ofile[fd])
+      nfdt->ofile[fd] = filedup(fdt->ofile[fd]);
+  release(&fdt->lock);
+  return nfdt;
+}
+
+// Increment ref count for fdt, for a new thread.
+struct fdtable*
+fdtdup(struct fdtable *fdt)
+{
+  acquire(&fdt->lock);
+  fdt->ref++;
+  release(&fdt->lock);
+  return fdt;
+}
+
+// Drop a reference to fdt.
+// The last one closes all the files and frees the table.
+void
+fdtclose(struct fdtable *fdt)
+{
+  acquire(&fdt->lock);
+  if(--fdt->ref > 0){
+    release(&fdt->lock);
+    return;
+  }
+  release(&fdt->lock);
+
+  for(int fd = 0; fd < NOFILE; fd++){
+    if(fdt->ofile[fd]){
+      fileclose(fdt->ofile[fd]);
+      fdt->ofile[fd] = 0;
+    }
+  }
+  kfree((uint64)fdt);
+}
+
 // Get metadata about file f.
 // addr is a user virtual address, pointing to a struct stat.
 int
@@ -91,10 +157,10 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilock_shared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
-    if(copyout(&p->uvm, addr, (char *)&st, sizeof(st)) < 0)
+    iunlock_shared(f->ip);
+    if(copyout(p->uvm, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
   }
@@ -118,10 +184,14 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
+    // Readers of the inode share its lock, so reads through
+    // the same open file take turns on f->readlock for f->off.
+    acquiresleep(&f->readlock);
+    ilock_shared(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
-    iunlock(f->ip);
+    iunlock_shared(f->ip);
+    releasesleep(&f->readlock);
   } else {
     panic("fileread");
   }
@@ -2,6 +2,7 @@
 #define FILE_H_
 
 #include "fs.h"
+#include "param.h"
 #include "types.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -14,9 +15,17 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  struct sleeplock readlock; // FD_INODE: serializes reads (see fileread())
   short major;       // FD_DEVICE
 };
 
+// Open files of a process, shared by its threads.
+struct fdtable {
+  struct spinlock lock;
+  int ref; // reference count
+  struct file *ofile[NOFILE];
+};
+
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
@@ -46,5 +55,6 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define PROF    2  // samples of the profiler (see prof.c)
 
 #endif
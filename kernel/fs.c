@@ -181,7 +181,7 @@ iinit()
 {
   int i = 0;
   
-  initlock(&itable.lock, "itable");
+  initmcslock(&itable.lock, "itable");
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
@@ -322,6 +322,35 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Lock the given inode for reading, sharing the lock with
+// other readers. Enough to readi() and stati(), not to modify it.
+void
+ilock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock_shared");
+
+  acquiresleep_shared(&ip->lock);
+  if(ip->valid == 0){
+    // Read it in under the exclusive lock. Our reference keeps
+    // iput() from invalidating it again.
+    releasesleep_shared(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquiresleep_shared(&ip->lock);
+  }
+}
+
+// Unlock an inode locked with ilock_shared().
+void
+iunlock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlock_shared");
+
+  releasesleep_shared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
 // be recycled.
@@ -449,7 +478,7 @@ stati(struct inode *ip, struct stat *st)
 }
 
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, maybe shared.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
@@ -636,21 +665,23 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    // Lookups only read the directory, so they can go in parallel.
+    ilock_shared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlock_shared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlock_shared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlock_shared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -0,0 +1,96 @@
+// Futexes: sleeping on a word of user memory.
+//
+// futex_wait() puts the caller to sleep as long as a word holds an
+// expected value, and futex_wake() wakes up processes waiting on a
+// word, so that user-level locks can block instead of spinning.
+//
+// The sleep channel is the physical address of the word, so threads
+// sharing an address space and processes sharing the page agree on
+// it whatever their virtual addresses. Private pages are made
+// writable (breaking copy-on-write) before looking up the address,
+// otherwise a later write by the waker would move the word to a new
+// page and the wakeup would be lost.
+//
+// The key is only looked up once, when the waiter goes to sleep. If
+// the word moves while it sleeps (a sibling thread munmap()s the page,
+// or a fork() makes it copy-on-write again and the next write copies
+// it), futex_wake() finds the new address, and the waiter is never
+// woken up, unless it has a timeout or is killed. Programs must not
+// unmap or fork over a word that threads are waiting on.
+//
+// A hashed lock per word is held while checking the value and going to
+// sleep, and while waking up, so a change of the value followed by a
+// futex_wake() can't slip in between the check and the sleep.
+
+#include "defs.h"
+#include "param.h"
+#include "proc.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "types.h"
+#include "uvm.h"
+
+#define NFUTEXLOCK 31
+
+struct spinlock futexlock[NFUTEXLOCK];
+
+void futexinit(void) {
+  for (int i = 0; i < NFUTEXLOCK; i++) initlock(&futexlock[i], "futex");
+}
+
+// The physical address of the word at user address addr,
+// or 0 if it is not a valid, writable word.
+static uint64 futex_key(uint64 addr) {
+  uint64 pa;
+
+  if (addr % sizeof(int) != 0) return 0;
+  pa = uvm_guaranteecomplete(myproc()->uvm, PGROUNDDOWN(addr), PTE_W);
+  if (pa == 0) return 0;
+  return pa + (addr - PGROUNDDOWN(addr));
+}
+
+static struct spinlock *futex_lock(uint64 key) {
+  return &futexlock[(key / sizeof(int)) % NFUTEXLOCK];
+}
+
+// Sleep until woken up by futex_wake() on addr, if *addr is val,
+// for at most timeout ticks (0 means no timeout).
+// Returns 0 when woken up or if *addr was not val,
+// -1 if the timeout expired, the process was killed or addr is invalid.
+int futex_wait(uint64 addr, int val, int timeout) {
+  uint64 key;
+  struct spinlock *lk;
+  int r = 0;
+
+  if (timeout < 0 || (key = futex_key(addr)) == 0) return -1;
+  lk = futex_lock(key);
+  acquire(lk);
+  if (myproc()->killed) {
+    r = -1;
+  } else if (__atomic_load_n((int *)key, __ATOMIC_SEQ_CST) == val) {
+    if (timeout > 0)
+      r = sleep_until((void *)key, lk,
+                      r_time() + (uint64)timeout * TICK_CYCLES);
+    else
+      sleep((void *)key, lk);
+    // kill() wakes the process up as well.
+    if (myproc()->killed) r = -1;
+  }
+  release(lk);
+  return r;
+}
+
+// Wake up at most n processes waiting on addr (all of them if n is 0).
+// Returns the number woken up, or -1 if addr is invalid.
+int futex_wake(uint64 addr, int n) {
+  uint64 key;
+  struct spinlock *lk;
+  int woken;
+
+  if (n < 0 || (key = futex_key(addr)) == 0) return -1;
+  lk = futex_lock(key);
+  acquire(lk);
+  woken = wakeup_n((void *)key, n);
+  release(lk);
+  return woken;
+}
@@ -26,7 +26,7 @@ struct {
 } kmem;
 
 void kinit() {
-  initlock(&kmem.lock, "kmem");
+  initmcslock(&kmem.lock, "kmem");
   freerange((uint64)end, (uint64)PHYSTOP);
 }
 
@@ -0,0 +1,125 @@
+// Spinlock contention statistics.
+//
+// In a kernel built with make LOCKSTAT=1, acquire() and release()
+// report every acquisition: where it was made from, whether the lock
+// was held by another hart and for how long it had to spin, and for how
+// long the lock was then held. They are summed up per lock name and
+// acquire() site in a table that getlockstat() copies out. Without
+// LOCKSTAT none of it is compiled in, and getlockstat() fails.
+//
+// The table cannot have a spinlock of its own. Its entries are claimed
+// by a compare-and-swap of their key, and updated with atomic adds, so
+// a reader may find the counters of an entry slightly out of step. The
+// key packs the name and site pointers into one word, since both are
+// kernel addresses below PHYSTOP, that is 2^32. Once the table is
+// full, further (name, site) pairs go unrecorded.
+
+#include "defs.h"
+#include "lockstat.h"
+#include "memlayout.h"
+#include "param.h"
+#include "proc.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "types.h"
+
+#ifdef LOCKSTAT
+
+struct lsentry {
+  uint64 key;  // name << 32 | site, 0 if free.
+  uint64 acquires;
+  uint64 contended;
+  uint64 spin;
+  uint64 maxhold;
+};
+
+static struct lsentry table[NLOCKSTAT];
+
+// Find the entry of name and site, claiming a free one if need be.
+// Returns 0 if the table is full.
+static struct lsentry *lookup(char *name, uint64 site) {
+  uint64 key = (uint64)name << 32 | (uint32)site, old;
+  uint i = ((key * 0x9e3779b97f4a7c15ull) >> 32) % NLOCKSTAT;
+
+  for (int n = 0; n < NLOCKSTAT; n++, i = (i + 1) % NLOCKSTAT) {
+    struct lsentry *e = &table[i];
+    old = __atomic_load_n(&e->key, __ATOMIC_RELAXED);
+    // If it was claimed meanwhile, old becomes its key.
+    if (old == 0)
+      __atomic_compare_exchange_n(&e->key, &old, key, 0, __ATOMIC_RELAXED,
+                                  __ATOMIC_RELAXED);
+    if (old == 0 || old == key) return e;
+  }
+  return 0;
+}
+
+// Called by acquire() once it holds lk, with interrupts off:
+// it was called from site, and spun for spin cycles if contended.
+void lockstat_acquire(struct spinlock *lk, uint64 site, int contended,
+                      uint64 spin) {
+  struct lsentry *e = lookup(lk->name, site);
+
+  lk->stat = e;
+  lk->acquired = r_time();
+  if (e == 0) return;
+  __atomic_fetch_add(&e->acquires, 1, __ATOMIC_RELAXED);
+  if (contended) {
+    __atomic_fetch_add(&e->contended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&e->spin, spin, __ATOMIC_RELAXED);
+  }
+}
+
+// Called by release() while it still holds lk.
+void lockstat_release(struct spinlock *lk) {
+  struct lsentry *e = lk->stat;
+  uint64 hold, max;
+
+  if (e == 0) return;
+  hold = r_time() - lk->acquired;
+  max = __atomic_load_n(&e->maxhold, __ATOMIC_RELAXED);
+  while (hold > max &&
+         !__atomic_compare_exchange_n(&e->maxhold, &max, hold, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+// Copy out the statistics of up to n locks to addr, in no particular
+// order, and return how many; or, if addr is 0, clear them all.
+int lockstat_read(uint64 addr, int n) {
+  struct lockstat st;
+  uint64 key;
+  int i, copied = 0;
+
+  for (i = 0; i < NLOCKSTAT; i++) {
+    struct lsentry *e = &table[i];
+    if (addr == 0) {
+      __atomic_store_n(&e->acquires, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&e->contended, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&e->spin, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&e->maxhold, 0, __ATOMIC_RELAXED);
+      continue;
+    }
+    if (copied == n) break;
+    if ((key = __atomic_load_n(&e->key, __ATOMIC_RELAXED)) == 0) continue;
+    if (key >> 32)
+      safestrcpy(st.name, (char *)(key >> 32), sizeof(st.name));
+    else
+      safestrcpy(st.name, "?", sizeof(st.name));
+    st.site = (uint32)key;
+    st.acquires = __atomic_load_n(&e->acquires, __ATOMIC_RELAXED);
+    st.contended = __atomic_load_n(&e->contended, __ATOMIC_RELAXED);
+    st.spin = __atomic_load_n(&e->spin, __ATOMIC_RELAXED);
+    st.maxhold = __atomic_load_n(&e->maxhold, __ATOMIC_RELAXED);
+    if (copyout(myproc()->uvm, addr + copied * sizeof(st), (char *)&st,
+                sizeof(st)) < 0)
+      return -1;
+    copied++;
+  }
+  return copied;
+}
+
+#else
+
+int lockstat_read(uint64 addr, int n) { return -1; }
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef LOCKSTAT_H_
+#define LOCKSTAT_H_
+
+#include "types.h"
+
+// Spinlock contention statistics, kept by kernels built with
+// make LOCKSTAT=1 (see lockstat.c) and read with getlockstat().
+// Locks are told apart by their name and the place they are acquired
+// from, so all the proc locks taken in a given function share an entry.
+struct lockstat {
+  char name[16];     // Name of the lock.
+  uint64 site;       // Return address of the acquire() call.
+  uint64 acquires;   // Times acquired.
+  uint64 contended;  // Times it was held by another hart.
+  uint64 spin;       // mtime cycles spent waiting for it.
+  uint64 maxhold;    // Longest it was held, mtime cycles.
+};
+
+#endif
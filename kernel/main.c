@@ -22,14 +22,17 @@ main()
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    vdsoinit();      // time page
     procinit();      // process table
-    trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
+    timerinithart(); // clock ticks and timers
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    profinit();      // profiler device
+    futexinit();     // futex locks
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -41,6 +44,7 @@ main()
     printf("hart %d starting\n", cpuid());
     kvminithart();    // turn on paging
     trapinithart();   // install kernel trap vector
+    timerinithart();  // clock ticks and timers
     plicinithart();   // ask PLIC for device interrupts
   }
 
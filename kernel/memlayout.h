@@ -29,6 +29,7 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // machine software interrupt.
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -64,7 +65,13 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   URING (the system call rings, once set up, see uring.c)
+//   VDSO (the time page, read-only, see vdso.c)
+//   trapframes of the other threads, down to TRAPFRAMEN(NTHREAD-1)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define TRAPFRAMEN(t) (TRAPFRAME - (t)*PGSIZE)
+#define VDSO TRAPFRAMEN(NTHREAD)
+#define URING (VDSO - PGSIZE)
 #define START_VMAS_ADDR (TRAPFRAME / 2)
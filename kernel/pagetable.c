@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "pagetable.h"
 #include "param.h"
+#include "spinlock.h"
 
 // ─────────────────────────────────────────────────────────────────────────────
 // Pagetable primitives
@@ -169,6 +170,14 @@ extern char trampoline[];
 // The kernel's page table.
 pagetable_t kernel_pagetable;
 
+// Serializes changes to kernel_pagetable after boot.
+struct spinlock kvm_lock;
+
+// Bumped whenever a mapping is added to kernel_pagetable after boot,
+// so that every hart knows to flush its TLB (see kvmsync()).
+int kvm_generation;
+int kvm_seen[NCPU];
+
 void kvmmap(uint64 va, uint64 pa, uint64 sz, uint64 flags) {
   if (va % PGSIZE != 0 || pa % PGSIZE != 0 || sz % PGSIZE != 0 || sz <= 0) {
     panic("kvmmap: Invalid addr\n");
@@ -188,6 +197,7 @@ void kvmmap(uint64 va, uint64 pa, uint64 sz, uint64 flags) {
 }
 
 void kvminit(void) {
+  initlock(&kvm_lock, "kvm");
   kernel_pagetable = pgt_new();
   if (kernel_pagetable == 0) panic("kernel pagetable = 0\n");
 
@@ -200,6 +210,9 @@ void kvminit(void) {
   // PLIC
   kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT, to send reschedule IPIs to other harts.
+  kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(KERNBASE, KERNBASE, (uint64)etext - KERNBASE, PTE_R | PTE_X);
 
@@ -209,21 +222,38 @@ void kvminit(void) {
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
-
-  // Allocate a page for each process's kernel stack.
-  // Map it high in memory, followed by an invalid
-  // guard page.
-  for (int i = 0; i < NPROC; i++) {
-    uint64 pa = (uint64)kalloc();
-    if (pa == 0) {
-      panic("kvminit: kalloc");
-    }
-    uint64 va = KSTACK(i);
-    kvmmap(va, pa, PGSIZE, PTE_R | PTE_W);
-  }
 }
 
 void kvminithart() {
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
 }
+
+int kvmmapstack(uint64 va) {
+  uint64 pa = kalloc();
+  pte_t* pte;
+
+  if (pa == 0) return -1;
+  acquire(&kvm_lock);
+  if ((pte = pgt_walk(kernel_pagetable, va, 1)) == 0) {
+    release(&kvm_lock);
+    kfree(pa);
+    return -1;
+  }
+  if (*pte & PTE_V) panic("kvmmapstack: remap");
+  *pte = PA2PTE(pa) | PTE_R | PTE_W | PTE_V;
+  __atomic_add_fetch(&kvm_generation, 1, __ATOMIC_RELEASE);
+  release(&kvm_lock);
+  sfence_vma();
+  return 0;
+}
+
+void kvmsync() {
+  int gen = __atomic_load_n(&kvm_generation, __ATOMIC_ACQUIRE);
+  int id = cpuid();
+
+  if (kvm_seen[id] != gen) {
+    kvm_seen[id] = gen;
+    sfence_vma();
+  }
+}
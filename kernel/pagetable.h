@@ -131,4 +131,21 @@ void kvmmap(uint64 va, uint64 pa, uint64 sz, uint64 flags);
  */
 void kvminithart();
 
+/**
+ * Allocate a kernel stack page and map it at va.
+ * The page below is left unmapped as a guard.
+ * May be called at any time; other harts see the mapping
+ * once they call kvmsync().
+ *
+ * @returns 0 on success.
+ * @returns -1 if out of memory.
+ */
+int kvmmapstack(uint64 va);
+
+/**
+ * Flush this hart's TLB if kernel mappings were added since the last flush.
+ * Must be called with interrupts disabled.
+ */
+void kvmsync();
+
 #endif
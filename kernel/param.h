@@ -1,4 +1,4 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC        64  // processes reported by getpinfo()
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
@@ -9,8 +9,22 @@
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUCKET      13  // hash buckets of the disk block cache
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MTIME_FREQ   10000000 // frequency of the mtime counter (qemu virt), Hz
+#define TICK_CYCLES  (MTIME_FREQ/10) // mtime cycles per clock tick
+#define REBALANCE_TICKS 10 // default ticks between run queue rebalances
+#define RT_PERIOD    10  // ticks over which the real-time budget is kept
+#define RT_BUDGET    90  // default real-time budget, percent of RT_PERIOD
+#define NWAITQ       64  // buckets of the sleep() wait queues
+#define NPIDHASH     64  // buckets of the pid hash table
+#define NTHREAD      64  // maximum threads sharing an address space
+#define NCURRENCY    16  // maximum ticket currencies
+#define NPROFBUF     1024  // samples buffered per hart by the profiler
+#define NLOCKSTAT    512  // (lock name, site) pairs kept by LOCKSTAT kernels
+#define NMCS         4  // MCS locks a cpu may hold or wait for at once
+#define SLEEPSPIN    500  // most mtime cycles to spin for a sleep lock
 
 #define VMA_SIZE 50 // maximun # of vma nodes per process
 
@@ -18,6 +18,9 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct proc *writer;  // last writer, lent the tickets of blocked readers
+  int writerpid;
+  int reading;    // a reader is copying data out (see piperead())
 };
 
 int
@@ -35,6 +38,9 @@ pipealloc(struct file **f0, struct file **f1)
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->writer = 0;
+  pi->writerpid = 0;
+  pi->reading = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -74,58 +80,103 @@ pipeclose(struct pipe *pi, int writable)
     release(&pi->lock);
 }
 
+// Bytes moved between the pipe and user memory at a time, through a
+// buffer on the kernel stack. copyin() and copyout() may fault a page
+// in, and so sleep or shoot down other harts, which cannot be done
+// while holding pi->lock.
+#define PIPECHUNK 128
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, j, m;
   struct proc *pr = myproc();
+  char buf[PIPECHUNK];
 
-  acquire(&pi->lock);
   while(i < n){
-    if(pi->readopen == 0 || pr->killed){
-      release(&pi->lock);
-      return -1;
-    }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(&pr->uvm, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    m = n - i < PIPECHUNK ? n - i : PIPECHUNK;
+    if(copyin(pr->uvm, buf, addr + i, m) == -1)
+      break;
+    acquire(&pi->lock);
+    for(j = 0; j < m; ){
+      if(pi->readopen == 0 || pr->killed){
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+      } else
+        pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
     }
+    i += m;
+    pi->writer = pr;
+    pi->writerpid = pr->pid;
+    wakeup(&pi->nread);
+    release(&pi->lock);
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
 
+// Readers take turns copying out: the data stays in the pipe, with
+// pi->lock released, until copyout() has succeeded, and only what was
+// copied out is consumed.
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, j, m, lent, r;
   struct proc *pr = myproc();
-  char ch;
+  struct proc *w;
+  int wpid;
+  char buf[PIPECHUNK];
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  for(;;){
     if(pr->killed){
       release(&pi->lock);
       return -1;
     }
+    if(pi->reading){
+      sleep(&pi->reading, &pi->lock);
+      continue;
+    }
+    if(pi->nread != pi->nwrite || !pi->writeopen)  //DOC: pipe-empty
+      break;
+    // lend our tickets to the writer we are waiting on.
+    w = pi->writer;
+    wpid = pi->writerpid;
+    lent = 0;
+    if(w && w != pr){
+      lent = tickets_value(pr);
+      tickets_lend(w, wpid, lent);
+    }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    if(lent)
+      tickets_lend(w, wpid, -lent);
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(&pr->uvm, addr + i, &ch, 1) == -1)
+  pi->reading = 1;
+  r = 0;
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    m = n - i;
+    if(m > PIPECHUNK)
+      m = PIPECHUNK;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    for(j = 0; j < m; j++)
+      buf[j] = pi->data[(pi->nread + j) % PIPESIZE];
+    release(&pi->lock);
+    r = copyout(pr->uvm, addr + i, buf, m);
+    acquire(&pi->lock);
+    if(r == -1)
       break;
+    pi->nread += m;
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pi->reading = 0;
+  wakeup(&pi->reading);
   release(&pi->lock);
+  if(i == 0 && r == -1)
+    return -1;
   return i;
 }
@@ -1,41 +1,74 @@
 #include "defs.h"
+#include "file.h"
 #include "kalloc.h"
 #include "memlayout.h"
+#include "pagetable.h"
 #include "param.h"
 #include "proc.h"
 #include "riscv.h"
+#include "rusage.h"
+#include "sched.h"
+#include "scstat.h"
 #include "spinlock.h"
 #include "types.h"
 #include "uvm.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// Process structures are carved out of pages as they are needed and,
+// once created, are never freed: an UNUSED one goes back to the free
+// list. A struct proc can thus be locked even after the process it
+// held has gone, which is what lets kill() and wait() look at a
+// process without keeping it from exiting.
+
+// Every struct proc ever created, linked through allnext.
+// Only ever grows at the head, so it can be walked without locks.
+struct proc *allproc;
+
+// UNUSED processes, linked through freenext.
+struct proc *freeproc_list;
+// Number of kernel stacks handed out; the next one goes at KSTACK(nkstack).
+int nkstack;
+struct spinlock freeproc_lock;
 
 struct proc *initproc;
 
 int nextpid = 1;
+
+// Processes with a pid, chained through pidnext in the bucket
+// of their pid. Acquired after p->lock.
+struct proc *pidhash[NPIDHASH];
 struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
-
-// helps ensure that wakeups of wait()ing
-// parents are not lost. helps obey the
-// memory model when using p->parent.
-// must be acquired before any p->lock.
-struct spinlock wait_lock;
+static void kidlink(struct proc **head, struct proc *np);
+static int sleep1(void *chan, struct spinlock *lk, int timed, uint64 deadline);
+
+// Processes sleeping on a channel are kept in the wait queue
+// of the bucket the channel hashes to, in the order they went to
+// sleep, so wakeup() only has to look at the sleepers that may match.
+// A bucket lock is acquired after the lock passed to sleep()
+// and before any p->lock.
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+} waitq[NWAITQ];
+
+static struct waitq *waitq_bucket(void *chan) {
+  uint64 a = (uint64)chan;
+  return &waitq[(a ^ (a >> 6) ^ (a >> 12)) % NWAITQ];
+}
 
 // initialize the proc table at boot time.
 void procinit(void) {
-  struct proc *p;
   uvminit();
-  initlock(&pid_lock, "nextpid");
-  initlock(&wait_lock, "wait_lock");
-  for (p = proc; p < &proc[NPROC]; p++) {
-    initlock(&p->lock, "proc");
-    p->kstack = KSTACK((int)(p - proc));
-  }
+  initlock(&freeproc_lock, "freeproc");
+  initlock(&pid_lock, "pidhash");
+  for (struct waitq *wq = waitq; wq < &waitq[NWAITQ]; wq++)
+    initlock(&wq->lock, "waitq");
+  runqinit();
 }
 
 // initialize the cpu variables at boot time
@@ -66,38 +99,95 @@ struct proc *myproc(void) {
   return p;
 }
 
-int allocpid() {
-  int pid;
+int allocpid() { return __sync_fetch_and_add(&nextpid, 1); }
+
+// Carve a page into new UNUSED procs, each with its own kernel stack,
+// and put them on the free list.
+// Caller must hold freeproc_lock.
+// Returns 0 if out of memory.
+static int procgrow(void) {
+  struct proc *p, *page;
+  int n = 0;
+
+  if ((page = (struct proc *)kalloc()) == 0) return 0;
+  memset(page, 0, PGSIZE);
+  for (p = page; p + 1 <= (struct proc *)((char *)page + PGSIZE); p++) {
+    if (kvmmapstack(KSTACK(nkstack))) break;
+    initlock(&p->lock, "proc");
+    initlock(&p->childlock, "children");
+    p->kstack = KSTACK(nkstack++);
+    p->state = UNUSED;
+    p->freenext = freeproc_list;
+    freeproc_list = p;
+    // Publish p fully initialized to lockless walkers of allproc.
+    p->allnext = allproc;
+    __sync_synchronize();
+    allproc = p;
+    n++;
+  }
+  if (n == 0) kfree((uint64)page);
+  return n;
+}
+
+// Look up the process with the given pid.
+// The result may have exited, or even been reused, by the time
+// the caller locks it, so it must check p->pid again.
+static struct proc *pidlookup(int pid) {
+  struct proc *p;
 
   acquire(&pid_lock);
-  pid = nextpid;
-  nextpid = nextpid + 1;
+  for (p = pidhash[pid % NPIDHASH]; p; p = p->pidnext) {
+    if (p->pid == pid) break;
+  }
   release(&pid_lock);
+  return p;
+}
 
-  return pid;
+// Remove p from the pid hash table.
+// Caller must hold p->lock.
+static void pidunhash(struct proc *p) {
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for (pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext) {
+    if (*pp == p) {
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  release(&pid_lock);
+  p->pidnext = 0;
 }
 
-// Look in the process table for an UNUSED proc.
+// Take a proc from the free list, creating more if needed.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// and return with p->lock held. The caller provides the
+// user memory and the open files.
+// If a memory allocation fails, return 0.
 static struct proc *allocproc(void) {
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if (p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  acquire(&freeproc_lock);
+  if (freeproc_list == 0 && procgrow() == 0) {
+    release(&freeproc_lock);
+    return 0;
   }
-  return 0;
+  p = freeproc_list;
+  freeproc_list = p->freenext;
+  release(&freeproc_lock);
 
-found:
+  acquire(&p->lock);
+  if (p->state != UNUSED) panic("allocproc");
+  p->freenext = 0;
   p->pid = allocpid();
+  acquire(&pid_lock);
+  p->pidnext = pidhash[p->pid % NPIDHASH];
+  pidhash[p->pid % NPIDHASH] = p;
+  release(&pid_lock);
   p->state = USED;
   p->ticks = 0;
+  p->cpu = -1;
+  p->affinity = ALLCPUS;
 
   // Allocate a trapframe page.
   if ((p->trapframe = (struct trapframe *)kalloc()) == 0) {
@@ -106,11 +196,13 @@ found:
     return 0;
   }
 
-  // An empty user page table.
-  if (uvm_new(&p->uvm, (uint64)p->trapframe)) {
+  // And one for its system call statistics.
+  if ((p->scstat = (struct scstat *)kalloc()) == 0) {
     freeproc(p);
     release(&p->lock);
+    return 0;
   }
+  memset(p->scstat, 0, sizeof(*p->scstat));
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -121,24 +213,53 @@ found:
   return p;
 }
 
-// free a proc structure and the data hanging from it,
-// including user pages.
+// free the data hanging from a proc structure
+// and put it back on the free list.
+// Its user memory and open files must have been released.
 // p->lock must be held.
 static void freeproc(struct proc *p) {
   if (p->trapframe) kfree((uint64)p->trapframe);
   p->trapframe = 0;
-  for (int i = 0; i < VMA_SIZE; i++) {
-    if (p->uvm.vma[i]) {
-      panic("freeproc: remaining vma\n");
-    }
-  }
+  if (p->scstat) kfree((uint64)p->scstat);
+  p->scstat = 0;
+  if (p->uvm || p->fdt) panic("freeproc: uvm or files");
+  p->tfva = 0;
+  pidunhash(p);
   p->pid = 0;
+  tickets_reset(p);
+  currency_leave(p);
+  p->comp = 0;
+  p->rtprio = 0;
+  p->utime = p->stime = 0;
+  p->cutime = p->cstime = 0;
   p->parent = 0;
+  p->thread = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
+
+  acquire(&freeproc_lock);
+  p->freenext = freeproc_list;
+  freeproc_list = p;
+  release(&freeproc_lock);
+}
+
+// Release what fork() or clone() had set up for np, and free it.
+static void abortproc(struct proc *np) {
+  if (np->uvm) {
+    if (np->tfva) uvm_delthread(np->uvm, np->tfva);
+    uvm_free(np->uvm);
+    np->uvm = 0;
+  }
+  if (np->fdt) {
+    fdtclose(np->fdt);
+    np->fdt = 0;
+  }
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
 }
 
 // a user program that calls exec("/init")
@@ -158,7 +279,11 @@ void userinit(void) {
   initproc = p;
 
   // Create uvm for the initial process.
-  code2uvm(&p->uvm, initcode, sizeof(initcode));
+  if ((p->uvm = uvm_new((uint64)p->trapframe)) == 0 ||
+      (p->fdt = fdtalloc()) == 0)
+    panic("userinit");
+  p->tfva = TRAPFRAME;
+  code2uvm(p->uvm, initcode, sizeof(initcode));
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -167,8 +292,9 @@ void userinit(void) {
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
   p->tickets = 1;
+  p->efftickets = 1;
 
-  p->state = RUNNABLE;
+  runq_add(p);
 
   release(&p->lock);
 }
@@ -176,7 +302,7 @@ void userinit(void) {
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int fork(void) {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
 
@@ -184,11 +310,24 @@ int fork(void) {
   if ((np = allocproc()) == 0) {
     return -1;
   }
+  // Copying the user memory may sleep.
+  // np is not runnable yet, so nobody else will touch it.
+  release(&np->lock);
 
   // Assign the child the same vmas as the father
-  if (uvm_dup(&p->uvm, &np->uvm)) {
-    freeproc(np);
-    release(&np->lock);
+  if ((np->uvm = uvm_new((uint64)np->trapframe)) == 0) {
+    abortproc(np);
+    return -1;
+  }
+  np->tfva = TRAPFRAME;
+  if (uvm_dup(p->uvm, np->uvm)) {
+    abortproc(np);
+    return -1;
+  }
+
+  // increment reference counts on open file descriptors.
+  if ((np->fdt = fdtcopy(p->fdt)) == 0) {
+    abortproc(np);
     return -1;
   }
 
@@ -198,221 +337,435 @@ int fork(void) {
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
-  // increment reference counts on open file descriptors.
-  for (i = 0; i < NOFILE; i++)
-    if (p->ofile[i]) np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
 
   // Assign the child the same number of tickets as the father.
   np->tickets = p->tickets;
+  np->efftickets = p->tickets;
+  currency_join(np, p->currency);
+  np->rtprio = p->rtprio;
+  np->affinity = p->affinity;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
+  acquire(&p->childlock);
+  np->parent = p;
+  kidlink(&p->children, np);
+  release(&p->childlock);
+
+  acquire(&np->lock);
+  runq_add(np);
   release(&np->lock);
 
-  acquire(&wait_lock);
+  return pid;
+}
+
+// Create a thread of the current process: it shares the user memory
+// and the open files, and starts running fn(arg) on the given stack.
+// fn must not return; the thread ends with exit(), and the caller
+// reaps it with join().
+// Returns the id of the new thread, or -1.
+int clone(uint64 fn, uint64 arg, uint64 stack) {
+  int tid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if ((np = allocproc()) == 0) {
+    return -1;
+  }
+  release(&np->lock);
+
+  np->uvm = uvm_share(p->uvm);
+  if ((np->tfva = uvm_addthread(np->uvm, (uint64)np->trapframe)) == 0) {
+    abortproc(np);
+    return -1;
+  }
+  np->fdt = fdtdup(p->fdt);
+
+  // Start at fn(arg), with the rest of the registers of the caller.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack & ~0xfL;  // riscv sp must be 16-byte aligned
+  np->trapframe->a0 = arg;
+
+  np->cwd = idup(p->cwd);
+  np->tickets = p->tickets;
+  np->efftickets = p->tickets;
+  currency_join(np, p->currency);
+  np->rtprio = p->rtprio;
+  np->affinity = p->affinity;
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  tid = np->pid;
+
+  acquire(&p->childlock);
   np->parent = p;
-  release(&wait_lock);
+  np->thread = 1;
+  kidlink(&p->children, np);
+  release(&p->childlock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  runq_add(np);
   release(&np->lock);
 
-  return pid;
+  return tid;
 }
 
-// Pass p's abandoned children to init.
-// Caller must hold wait_lock.
-void reparent(struct proc *p) {
+// Link np at the head of a list of children or zombies.
+static void kidlink(struct proc **head, struct proc *np) {
+  np->sibprev = 0;
+  np->sibnext = *head;
+  if (*head) (*head)->sibprev = np;
+  *head = np;
+}
+
+// Unlink np from a list of children or zombies.
+static void kidunlink(struct proc **head, struct proc *np) {
+  if (np->sibprev)
+    np->sibprev->sibnext = np->sibnext;
+  else
+    *head = np->sibnext;
+  if (np->sibnext) np->sibnext->sibprev = np->sibprev;
+  np->sibnext = np->sibprev = 0;
+}
+
+// Acquire the childlock of p's parent, and return the parent.
+// The parent may be exiting and pass p to init meanwhile,
+// so look again once the lock is held.
+static struct proc *lockparent(struct proc *p) {
   struct proc *pp;
 
-  for (pp = proc; pp < &proc[NPROC]; pp++) {
-    if (pp->parent == p) {
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  for (;;) {
+    pp = __atomic_load_n(&p->parent, __ATOMIC_ACQUIRE);
+    acquire(&pp->childlock);
+    if (p->parent == pp) return pp;
+    release(&pp->childlock);
   }
 }
 
+// Pass p's abandoned children, alive or zombies, to init.
+void reparent(struct proc *p) {
+  struct proc *pp;
+  int zombies = 0;
+
+  // Only init's childlock is ever held together with another.
+  acquire(&p->childlock);
+  acquire(&initproc->childlock);
+  while ((pp = p->children) != 0) {
+    kidunlink(&p->children, pp);
+    __atomic_store_n(&pp->parent, initproc, __ATOMIC_RELEASE);
+    kidlink(&initproc->children, pp);
+  }
+  while ((pp = p->zombies) != 0) {
+    kidunlink(&p->zombies, pp);
+    __atomic_store_n(&pp->parent, initproc, __ATOMIC_RELEASE);
+    kidlink(&initproc->zombies, pp);
+    zombies = 1;
+  }
+  if (zombies) wakeup(initproc);
+  release(&initproc->childlock);
+  release(&p->childlock);
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait().
 void exit(int status) {
   struct proc *p = myproc();
+  struct proc *pp;
 
   if (p == initproc) panic("init exiting");
 
-  // Close all open files.
-  for (int fd = 0; fd < NOFILE; fd++) {
-    if (p->ofile[fd]) {
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // Close all open files, unless other threads still use them.
+  fdtclose(p->fdt);
+  p->fdt = 0;
 
-  // Unmap all shared memory
-  uvm_free(&p->uvm);
+  // Unmap all shared memory, unless other threads still use it.
+  uvm_delthread(p->uvm, p->tfva);
+  uvm_free(p->uvm);
+  p->uvm = 0;
 
   begin_op();
   iput(p->cwd);
   end_op();
   p->cwd = 0;
 
-  acquire(&wait_lock);
-
   // Give any children to init.
   reparent(p);
 
-  // Parent might be sleeping in wait().
-  wakeup(p->parent);
+  // Move to the zombies of the parent,
+  // which might be sleeping in wait().
+  pp = lockparent(p);
+  kidunlink(&pp->children, p);
+  kidlink(&pp->zombies, p);
+  wakeup(pp);
 
   acquire(&p->lock);
 
   p->xstate = status;
   p->state = ZOMBIE;
 
-  release(&wait_lock);
+  release(&pp->childlock);
 
   // Jump into the scheduler, never to return.
   sched();
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int wait(uint64 addr) {
+// Is np one of the children reap(tid) waits for?
+static int waitsfor(struct proc *np, int tid) {
+  return tid ? np->thread && np->pid == tid : !np->thread;
+}
+
+// Lend n tickets to each of the children reap(tid) waits for.
+// Caller must hold p->childlock, so that they stay p's children.
+static void lendkids(struct proc *p, int tid, int n) {
   struct proc *np;
-  int havekids, pid;
+
+  if (n == 0) return;
+  for (np = p->children; np; np = np->sibnext) {
+    if (waitsfor(np, tid)) tickets_lend(np, np->pid, n);
+  }
+}
+
+// Wait for a child to exit and return its pid:
+// any child process if tid is 0, otherwise the thread tid.
+// Return -1 if there is no such child.
+static int reap(int tid, uint64 addr, uint64 ruaddr, uint64 scaddr) {
+  struct proc *np, *next;
+  int havekids, pid, share, xstate;
+  struct rusage ru;
+  struct scstat *sc;
   struct proc *p = myproc();
 
-  acquire(&wait_lock);
+  // Everything is copied out once the locks below are released, as
+  // copyout() may have to fault a page in; but a bad address should
+  // fail before the child is reaped. (A sibling thread may still unmap
+  // the page meanwhile, and then the child is lost.)
+  if (addr != 0 &&
+      uvm_guaranteecomplete(p->uvm, PGROUNDDOWN(addr), PTE_W) == 0)
+    return -1;
+  if (ruaddr != 0 &&
+      (uvm_guaranteecomplete(p->uvm, PGROUNDDOWN(ruaddr), PTE_W) == 0 ||
+       uvm_guaranteecomplete(p->uvm, PGROUNDDOWN(ruaddr + sizeof(ru) - 1),
+                             PTE_W) == 0))
+    return -1;
+  if (scaddr != 0 &&
+      (uvm_guaranteecomplete(p->uvm, PGROUNDDOWN(scaddr), PTE_W) == 0 ||
+       uvm_guaranteecomplete(p->uvm, PGROUNDDOWN(scaddr + sizeof(*sc) - 1),
+                             PTE_W) == 0))
+    return -1;
+
+  acquire(&p->childlock);
 
   for (;;) {
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for (np = proc; np < &proc[NPROC]; np++) {
-      if (np->parent == p) {
+    // Look for an exited child.
+    for (np = p->zombies; np; np = next) {
+      next = np->sibnext;
+      if (np->thread && p == initproc) {
+        // A thread whose creator exited; nobody will join it.
+        kidunlink(&p->zombies, np);
+        acquire(&np->lock);
+        freeproc(np);
+        release(&np->lock);
+      } else if (waitsfor(np, tid)) {
         // make sure the child isn't still in exit() or swtch().
         acquire(&np->lock);
-
-        havekids = 1;
-        if (np->state == ZOMBIE) {
-          // Found one.
-          pid = np->pid;
-          if (addr != 0 && copyout(&p->uvm, addr, (char *)&np->xstate,
-                                   sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(np);
-          release(&np->lock);
-          release(&wait_lock);
-          return pid;
+        pid = np->pid;
+        // What the child used, including its own reaped children.
+        ru.utime = np->utime + np->cutime;
+        ru.stime = np->stime + np->cstime;
+        xstate = np->xstate;
+        p->cutime += ru.utime;
+        p->cstime += ru.stime;
+        // Keep the statistics page from freeproc().
+        sc = 0;
+        if (scaddr != 0) {
+          sc = np->scstat;
+          np->scstat = 0;
         }
+        kidunlink(&p->zombies, np);
+        freeproc(np);
         release(&np->lock);
+        release(&p->childlock);
+        if ((addr != 0 &&
+             copyout(p->uvm, addr, (char *)&xstate, sizeof(xstate)) < 0) ||
+            (ruaddr != 0 &&
+             copyout(p->uvm, ruaddr, (char *)&ru, sizeof(ru)) < 0) ||
+            (sc && copyout(p->uvm, scaddr, (char *)sc, sizeof(*sc)) < 0))
+          pid = -1;
+        if (sc) kfree((uint64)sc);
+        return pid;
       }
     }
 
     // No point waiting if we don't have any children.
+    havekids = 0;
+    for (np = p->children; np; np = np->sibnext) {
+      if (waitsfor(np, tid)) havekids++;
+    }
     if (!havekids || p->killed) {
-      release(&wait_lock);
+      release(&p->childlock);
       return -1;
     }
 
-    // Wait for a child to exit.
-    sleep(p, &wait_lock);  // DOC: wait-sleep
+    // Wait for a child to exit,
+    // lending it our tickets in the meantime.
+    share = tickets_value(p) / havekids;
+    lendkids(p, tid, share);
+    sleep(p, &p->childlock);  // DOC: wait-sleep
+    lendkids(p, tid, -share);
+  }
+}
+
+// Wait for a child process to exit and return its pid.
+// Its exit status is copied out to addr, the resources it used
+// to ruaddr and its system call statistics to scaddr, unless they
+// are 0. Return -1 if this process has no children.
+int wait(uint64 addr, uint64 ruaddr, uint64 scaddr) {
+  return reap(0, addr, ruaddr, scaddr);
+}
+
+// Wait for the thread tid, created by this process with clone(),
+// to exit and return tid.
+// Return -1 if there is no such thread.
+int join(int tid) {
+  if (tid <= 0) return -1;
+  return reap(tid, 0, 0, 0);
+}
+
+// Charge the time since p was last accounted for to its user
+// time, if it was in user mode, or to its system time.
+// Called at each trap from and return to user space, and at each
+// swtch(), with interrupts off.
+void acct(struct proc *p, int user) {
+  uint64 now = r_time();
+
+  if (user)
+    p->utime += now - p->tstamp;
+  else
+    p->stime += now - p->tstamp;
+  p->tstamp = now;
+}
+
+// Make p, which has been taken off the run queues and whose lock is
+// held, the process running on c. The caller then swtch()es to it.
+static void run(struct cpu *c, struct proc *p) {
+  if (p->state != RUNNABLE) panic("run: not runnable");
+  p->state = RUNNING;
+  p->ticks += 1;
+  p->cpu = c - cpus;
+  c->proc = p;
+  c->runstart = r_time();
+  p->tstamp = c->runstart;
+  // Its kernel stack may have been mapped since this CPU last looked.
+  kvmsync();
+}
+
+// Called right after coming back from swtch(): release the lock
+// of the process that switched here, if it was not the scheduler.
+static void finishswitch(void) {
+  struct cpu *c = mycpu();
+  struct proc *prev = c->prev;
+
+  if (prev) {
+    c->prev = 0;
+    // A yield()ing process is only queued now that its context is
+    // saved. Otherwise a cpu picking it could wait for its lock while
+    // holding the lock of a process this cpu is waiting to pick.
+    if (prev->state == RUNNABLE) runq_add(prev);
+    release(&prev->lock);
   }
 }
 
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run from this CPU's run queue,
+//    or steal one from a busier CPU.
+//  - if there is none, sleep in wfi until another CPU queues one.
 //  - swtch to start running that process.
-//  - eventually that process transfers control
-//    via swtch back to the scheduler.
+//  - eventually a process (that one, or another one it switched
+//    to directly, see sched()) finds nothing to run and transfers
+//    control via swtch back to the scheduler.
 void scheduler(void) {
   struct proc *p;
   struct cpu *c = mycpu();
-  int tickets_partial_sums[NPROC + 1];
-  int winner_ticket;
-  int lo, hi, med;
 
   c->proc = 0;
+  c->online = 1;
   for (;;) {
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    tickets_partial_sums[0] = 0;
-    for (int i = 0; i < NPROC; i++) {
-      tickets_partial_sums[i + 1] = tickets_partial_sums[i];
-      acquire(&proc[i].lock);
-      if (proc[i].state == RUNNABLE) {
-        tickets_partial_sums[i + 1] += proc[i].tickets;
-      }
-      release(&proc[i].lock);
+    if ((p = runq_pick(c, 0)) == 0) {
+      runq_idle(c);
+      continue;
     }
 
-    // If total number of playing tickets is 0
-    // there is no process to schedule right now.
-    if (tickets_partial_sums[NPROC] == 0) continue;
-
-    winner_ticket = rand(&c->rng) % tickets_partial_sums[NPROC];
-
-    // Binary search the winner proc
-    lo = 0;
-    hi = NPROC;
-    while (hi - lo > 1) {
-      med = (lo + hi) / 2;
-      if (winner_ticket < tickets_partial_sums[med]) {
-        hi = med;
-      } else {
-        lo = med;
-      }
-    }
-    p = proc + lo;
-
-    // Assign the CPU
+    // Assign the CPU. The process is off every run queue,
+    // so no other CPU can pick it in the meantime.
     acquire(&p->lock);
-    if (p->state == RUNNABLE) {
-      // Switch to chosen process.  It is the process's job
-      // to release its lock and then reacquire it
-      // before jumping back to us.
-      p->state = RUNNING;
-      p->ticks += 1;
-      c->proc = p;
-      swtch(&c->context, &p->context);
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
-    }
-    release(&p->lock);
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    run(c, p);
+    swtch(&c->context, &p->context);
+
+    // Some process is done running for now.
+    // It has changed its state, and left its lock for us to release.
+    c->proc = 0;
+    finishswitch();
   }
 }
 
-// Switch to scheduler.  Must hold only p->lock
+// Give up the cpu.  Must hold only p->lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
 // be proc->intena and proc->noff, but that would
 // break in the few places where a lock is held but
 // there's no process.
+//
+// The next process is chosen right here and switched to
+// directly, saving a trip through the scheduler thread (a swtch()
+// and a pass of its loop); only if there is none to run does p
+// switch to the scheduler, to idle. Either way p->lock stays held
+// until p's context is saved, and whoever runs next releases it
+// (see finishswitch()).
 void sched(void) {
   int intena;
   struct proc *p = myproc();
+  struct cpu *c = mycpu();
+  struct proc *np = 0;
 
   if (!holding(&p->lock)) panic("sched p->lock");
-  if (mycpu()->noff != 1) panic("sched locks");
+  if (c->noff != 1) panic("sched locks");
   if (p->state == RUNNING) panic("sched running");
   if (intr_get()) panic("sched interruptible");
 
-  intena = mycpu()->intena;
-  swtch(&p->context, &mycpu()->context);
+  acct(p, 0);
+  runq_done(p, p->tstamp - c->runstart);
+  intena = c->intena;
+  // A yield()ing p takes part in the choice.
+  if (sched_direct) np = runq_pick(c, p->state == RUNNABLE ? p : 0);
+  if (np == p) {
+    run(c, p);
+  } else if (np) {
+    acquire(&np->lock);
+    run(c, np);
+    c->prev = p;
+    swtch(&p->context, &np->context);
+    finishswitch();
+  } else {
+    c->proc = 0;
+    c->prev = p;
+    swtch(&p->context, &c->context);
+    finishswitch();
+  }
   mycpu()->intena = intena;
 }
 
@@ -420,7 +773,7 @@ void sched(void) {
 void yield(void) {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  p->state = RUNNABLE;  // queued by finishswitch(), unless it goes on
   sched();
   release(&p->lock);
 }
@@ -430,7 +783,9 @@ void yield(void) {
 void forkret(void) {
   static int first = 1;
 
-  // Still holding p->lock from scheduler.
+  // Still holding p->lock from scheduler() or sched(),
+  // and maybe the lock of the process that switched here.
+  finishswitch();
   release(&myproc()->lock);
 
   if (first) {
@@ -444,71 +799,230 @@ void forkret(void) {
   usertrapret();
 }
 
+// Remove p from the wait queue wq.
+// Caller must hold wq->lock.
+static void waitq_remove(struct waitq *wq, struct proc *p) {
+  if (p->wqprev)
+    p->wqprev->wqnext = p->wqnext;
+  else
+    wq->head = p->wqnext;
+  if (p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+  else
+    wq->tail = p->wqprev;
+  p->wqnext = p->wqprev = 0;
+  p->chan = 0;
+}
+
+// Timer function ending a sleep_until(): wake up the process.
+static void timeout(void *arg) {
+  struct proc *p = arg;
+
+  acquire(&p->lock);
+  p->timedout = 1;
+  if (p->state == SLEEPING) runq_add(p);
+  release(&p->lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
-void sleep(void *chan, struct spinlock *lk) {
-  struct proc *p = myproc();
-
-  // Must acquire p->lock in order to
-  // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
+void sleep(void *chan, struct spinlock *lk) { sleep1(chan, lk, 0, 0); }
 
-  acquire(&p->lock);  // DOC: sleeplock1
-  release(lk);
+// Like sleep(), but give up once mtime reaches deadline.
+// Returns 0 when woken up, -1 if the deadline passed first.
+// With a null chan (and lk), only the deadline or kill() end the sleep.
+int sleep_until(void *chan, struct spinlock *lk, uint64 deadline) {
+  return sleep1(chan, lk, 1, deadline);
+}
 
-  // Go to sleep.
-  p->chan = chan;
-  p->state = SLEEPING;
+static int sleep1(void *chan, struct spinlock *lk, int timed,
+                  uint64 deadline) {
+  struct proc *p = myproc();
+  struct waitq *wq = waitq_bucket(chan);
+  int timedout;
+
+  if (timed) timer_add(&p->timer, deadline, timeout, p);
+
+  // Must be on the wait queue of chan before releasing lk,
+  // so that wakeup() can find us, and must hold p->lock
+  // in order to change p->state and then call sched.
+  // wakeup() locks p->lock before waking us,
+  // so it can't do it until we are SLEEPING.
+
+  if (chan) {
+    acquire(&wq->lock);  // DOC: sleeplock1
+    p->chan = chan;
+    p->wqprev = wq->tail;
+    p->wqnext = 0;
+    if (wq->tail)
+      wq->tail->wqnext = p;
+    else
+      wq->head = p;
+    wq->tail = p;
+    acquire(&p->lock);
+    release(&wq->lock);
+    release(lk);
+  } else {
+    acquire(&p->lock);
+  }
 
-  sched();
+  // Go to sleep, unless the deadline has passed already.
+  if (!p->timedout) {
+    p->state = SLEEPING;
+    sched();
+  }
 
-  // Tidy up.
-  p->chan = 0;
+  // Tidy up. wakeup() has already dequeued us,
+  // unless we were woken by kill() or the deadline.
+  release(&p->lock);
+  if (chan) {
+    acquire(&wq->lock);
+    if (p->chan) waitq_remove(wq, p);
+    release(&wq->lock);
+  }
+  // Once the timer is off, nothing else sets timedout.
+  if (timed) timer_del(&p->timer);
+  timedout = p->timedout;
+  p->timedout = 0;
 
   // Reacquire original lock.
-  release(&p->lock);
-  acquire(lk);
+  if (lk) acquire(lk);
+  return timedout ? -1 : 0;
 }
 
-// Wake up all processes sleeping on chan.
+// Wake up processes sleeping on chan, at most n if n > 0.
+// Returns the number of processes woken up.
 // Must be called without any p->lock.
-void wakeup(void *chan) {
-  struct proc *p;
-
-  for (p = proc; p < &proc[NPROC]; p++) {
-    if (p != myproc()) {
-      acquire(&p->lock);
-      if (p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+int wakeup_n(void *chan, int n) {
+  struct waitq *wq = waitq_bucket(chan);
+  struct proc *p, *next;
+  int woken = 0;
+
+  acquire(&wq->lock);
+  for (p = wq->head; p; p = next) {
+    next = p->wqnext;
+    if (p->chan != chan) continue;
+    acquire(&p->lock);
+    // A process woken by kill() stays queued until it runs;
+    // it is not waiting any more.
+    if (p->state == SLEEPING) {
+      waitq_remove(wq, p);
+      runq_add(p);
+      woken++;
     }
+    release(&p->lock);
+    if (n > 0 && woken == n) break;
   }
+  release(&wq->lock);
+  return woken;
 }
 
+// Wake up all processes sleeping on chan.
+// Must be called without any p->lock.
+void wakeup(void *chan) { wakeup_n(chan, 0); }
+
+// Wake up the process that has been sleeping on chan the longest.
+// For channels where a single waiter can make progress.
+// Must be called without any p->lock.
+void wakeup_one(void *chan) { wakeup_n(chan, 1); }
+
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
 int kill(int pid) {
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if (p->pid == pid) {
-      p->killed = 1;
-      if (p->state == SLEEPING) {
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  if (pid <= 0 || (p = pidlookup(pid)) == 0) return -1;
+  acquire(&p->lock);
+  if (p->pid != pid) {
+    // Exited in the meantime.
+    release(&p->lock);
+    return -1;
+  }
+  p->killed = 1;
+  if (p->state == SLEEPING) {
+    // Wake process from sleep().
+    runq_add(p);
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// Set the scheduling class of the process pid, or of the caller if
+// pid is 0: policy is SCHED_NORMAL, or SCHED_FIFO with a real-time
+// priority prio (see sched.h).
+int sched_setattr(int pid, int policy, int prio) {
+  struct proc *p;
+
+  if (policy != SCHED_NORMAL && policy != SCHED_FIFO) return -1;
+  if (policy == SCHED_NORMAL && prio != 0) return -1;
+  if (policy == SCHED_FIFO && (prio < 1 || prio > RTPRIO_MAX)) return -1;
+  if (pid < 0) return -1;
+  if (pid == 0)
+    p = myproc();
+  else if ((p = pidlookup(pid)) == 0)
+    return -1;
+  acquire(&p->lock);
+  if (pid != 0 && p->pid != pid) {
+    // Exited in the meantime.
     release(&p->lock);
+    return -1;
+  }
+  runq_setprio(p, prio);
+  release(&p->lock);
+  // A lower priority may have to give way at once.
+  if (p == myproc()) yield();
+  return 0;
+}
+
+// Restrict the process pid, or the caller if pid is 0, to the harts
+// in mask, a bit per hart. At least one of them must be online.
+int sched_setaffinity(int pid, uint64 mask) {
+  struct proc *p;
+  int online = 0;
+
+  mask &= ALLCPUS;
+  for (struct cpu *c = cpus; c < &cpus[NCPU]; c++) {
+    if (c->online && (mask >> (c - cpus) & 1)) online = 1;
+  }
+  if (!online || pid < 0) return -1;
+  if (pid == 0)
+    p = myproc();
+  else if ((p = pidlookup(pid)) == 0)
+    return -1;
+  acquire(&p->lock);
+  if (pid != 0 && p->pid != pid) {
+    // Exited in the meantime.
+    release(&p->lock);
+    return -1;
   }
-  return -1;
+  runq_setaffinity(p, mask);
+  release(&p->lock);
+  // Move off this hart at once if it is no longer allowed.
+  if (p == myproc()) yield();
+  return 0;
+}
+
+// Copy the system call statistics of the process pid, or of the
+// caller if pid is 0, to st.
+// Returns 0, or -1 if there is no such process.
+int proc_scstat(int pid, struct scstat *st) {
+  struct proc *p;
+
+  if (pid < 0) return -1;
+  if (pid == 0)
+    p = myproc();
+  else if ((p = pidlookup(pid)) == 0)
+    return -1;
+  acquire(&p->lock);
+  if (pid != 0 && p->pid != pid) {
+    // Exited and reaped in the meantime.
+    release(&p->lock);
+    return -1;
+  }
+  memmove(st, p->scstat, sizeof(*st));
+  release(&p->lock);
+  return 0;
 }
 
 // Copy to either a user address, or kernel address,
@@ -517,7 +1031,7 @@ int kill(int pid) {
 int either_copyout(int user_dst, uint64 dst, void *src, uint64 len) {
   struct proc *p = myproc();
   if (user_dst) {
-    return copyout(&p->uvm, dst, src, len);
+    return copyout(p->uvm, dst, src, len);
   } else {
     memmove((char *)dst, src, len);
     return 0;
@@ -530,7 +1044,7 @@ int either_copyout(int user_dst, uint64 dst, void *src, uint64 len) {
 int either_copyin(void *dst, int user_src, uint64 src, uint64 len) {
   struct proc *p = myproc();
   if (user_src) {
-    return copyin(&p->uvm, dst, src, len);
+    return copyin(p->uvm, dst, src, len);
   } else {
     memmove(dst, (char *)src, len);
     return 0;
@@ -550,7 +1064,7 @@ void procdump(void) {
   char *state;
 
   printf("\n");
-  for (p = proc; p < &proc[NPROC]; p++) {
+  for (p = allproc; p; p = p->allnext) {
     if (p->state == UNUSED) continue;
     if (p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
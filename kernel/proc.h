@@ -3,6 +3,7 @@
 
 #include "random.h"
 #include "spinlock.h"
+#include "timer.h"
 #include "uvm.h"
 
 // Saved registers for kernel context switches.
@@ -25,17 +26,50 @@ struct context {
   uint64 s11;
 };
 
+// Per-CPU queue of RUNNABLE processes (see sched.c).
+struct runq {
+  struct spinlock lock;
+  struct proc *head;          // Queued normal processes, oldest first.
+  struct proc *tail;
+  struct proc *rthead;        // Queued real-time processes,
+  struct proc *rttail;        // highest priority first.
+  int nproc;                  // Number of queued processes.
+  int nrt;                    // How many of them are real-time.
+  int tickets;                // Sum of the efftickets of the queued processes.
+  uint64 pass;                // Pass of the last process picked.
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
+  struct proc *prev;          // Process switched out of, to be unlocked.
+  uint64 runstart;            // mtime when c->proc started running.
   struct rng rng;             // Random number generator.
+  struct runq rq;             // Processes waiting to run on this cpu.
+  struct wheel wheel;         // Timers expiring on this cpu.
+  uint64 nexttick;            // mtime of the next clock tick, or -1.
+  int tickless;               // Has it stopped its clock tick?
+  uint64 ticks;               // Clock ticks taken.
+  int online;                 // Has this cpu entered scheduler()?
+  int idle;                   // Is it waiting for work in wfi?
+  uint64 idletime;            // Cycles spent idle.
+  uint64 tlbreq;              // TLB flushes asked by other cpus, and
+  uint64 tlbdone;             // the last of them done (uvm_shootdown()).
+  int resched;                // Asked by another cpu to preempt c->proc.
+  uint64 rtperiod;            // mtime the current real-time period ends.
+  uint64 rtused;              // Cycles real-time processes ran in it.
+  uint64 slspins;             // Sleep locks got by spinning for them.
+  uint64 slsleeps;            // Sleeps waiting for a sleep lock.
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
 };
 
 extern struct cpu cpus[NCPU];
 
+// Affinity mask of every hart.
+#define ALLCPUS (((uint64)1 << NCPU) - 1)
+
 // per-process data for the trap handling code in trampoline.S.
 // sits in a page by itself just under the trampoline page in the
 // user page table. not specially mapped in the kernel page table.
@@ -96,23 +130,68 @@ struct proc {
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
+  int timedout;                // sleep_until() deadline passed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
   int tickets;                 // Number of lottery planification tickets.
+  int efftickets;              // Value of the tickets when last queued
+  int comp;                    // Compensation factor, see runq_done()
+  int rtprio;                  // Real-time priority, 0 if normal; also
+                               // under its run queue's lock if queued
+  uint64 affinity;             // Harts it may run on, a bit each; idem
+  struct currency *currency;   // Currency of the tickets, 0 for base
+  int active;                  // Counted in its currency's active tickets
   uint ticks;                  // Number of times the process has been scheduled
+  int cpu;                     // Cpu whose run queue the process last used
+
+  // the lock of the run queue holding the process must be held
+  // when using these:
+  struct proc *rqnext;         // Run queue links
+  struct proc *rqprev;
+  uint64 pass;                 // Stride scheduling virtual time
 
-  // wait_lock must be held when using this:
+  // the lock of the wait queue chan hashes to must be held
+  // when using these:
+  void *chan;                  // If non-zero, sleeping on chan
+  struct proc *wqnext;         // Wait queue links
+  struct proc *wqprev;
+
+  struct timer timer;          // Ends sleep_until(), under its wheel's lock
+
+  // the parent's childlock must be held when using these:
   struct proc *parent;         // Parent process
+  int thread;                  // Created by clone(), reaped by join()
+  struct proc *sibnext;        // Parent's children or zombies list links
+  struct proc *sibprev;
+
+  // helps ensure that wakeups of wait()ing parents are not lost.
+  // acquired before any p->lock. childlock must be held when
+  // using these:
+  struct spinlock childlock;
+  struct proc *children;       // Children that have not exited
+  struct proc *zombies;        // Exited children, for wait() to reap
+
+  struct proc *allnext;        // Next in allproc, set once at creation
+  struct proc *freenext;       // Free list link, under freeproc_lock
+  struct proc *pidnext;        // Pid hash chain, under pid_lock
+  int lent;                    // Tickets lent by blocked processes,
+                               // under transfer_lock
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  struct uvm uvm;              // User virtual memory
+  struct uvm *uvm;             // User virtual memory, shared by threads
   struct trapframe *trapframe; // data page for trampoline.S
+  struct scstat *scstat;       // System call statistics, a page
+  uint64 tfva;                 // User virtual address of trapframe
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct fdtable *fdt;         // Open files, shared by threads
   struct inode *cwd;           // Current directory
+  uint64 utime;                // Cycles run in user mode
+  uint64 stime;                // Cycles run in the kernel
+  uint64 tstamp;               // When utime or stime was last charged
+  uint64 cutime;               // utime and stime of reaped children
+  uint64 cstime;
   char name[16];               // Process name (debugging)
 };
 
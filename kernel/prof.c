@@ -0,0 +1,173 @@
+// Sampling profiler.
+//
+// While profiling is on, every hart arms a timer of its own (see
+// timer.c) for every 1/hz seconds. The timer function only marks the
+// sample as due: it runs with the wheel lock held, deep in devintr().
+// The sample is taken by prof_intr(), which usertrap() and kerneltrap()
+// call after any device interrupt, since they know what was
+// interrupted: the pc, the mode and the frame pointer, s0. It then
+// arms the timer again. A hart that is idle and tickless arms its timer
+// at the first interrupt it takes after profiling has been turned on.
+//
+// Besides the pc, a sample keeps the return addresses of up to
+// PROF_DEPTH-1 callers, found by following the frame pointers that
+// -fno-omit-frame-pointer keeps: the frame of a function holds its
+// return address at fp-8 and the frame pointer of its caller at fp-16.
+// A kernel walk stays on the page of the kernel stack where it starts;
+// a user walk reads the user stack through the page table, so that it
+// never faults, and stops at the first frame that is not mapped. The
+// frames are not checked further: a pc sampled in the prologue of a
+// function, before it has set up s0, misses its caller.
+//
+// Each hart appends its samples to a ring buffer of its own, and drops
+// them when it is full. Reading the PROF device moves whole samples out
+// of the buffers of all harts; kernel/kernel.sym and user/*.sym turn
+// them into function names (see user/profsym.pl).
+
+#include "defs.h"
+#include "file.h"
+#include "memlayout.h"
+#include "pagetable.h"
+#include "param.h"
+#include "proc.h"
+#include "prof.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "types.h"
+
+struct profcpu {
+  struct spinlock lock;  // Protects the buffer, against the reader.
+  uint head;             // Next sample to read.
+  uint tail;             // Next sample to write.
+  struct profsample buf[NPROFBUF];
+
+  // Only touched by the hart itself, with interrupts off.
+  struct timer timer;  // Sampling timer.
+  int armed;           // Is the timer on the wheel?
+  int due;             // Has it gone off since the last sample?
+};
+
+static struct profcpu profcpus[NCPU];
+
+// mtime cycles between samples, or 0 when profiling is off.
+static uint64 profperiod;
+
+static void prof_due(void *arg) {
+  struct profcpu *pc = arg;
+
+  pc->armed = 0;
+  pc->due = 1;
+}
+
+// Follow the kernel frame pointer fp of p (which may be null),
+// filling s->pc[] from s->depth.
+static void kwalk(struct profsample *s, struct proc *p, uint64 fp) {
+  uint64 base, next;
+
+  if (fp < 16) return;
+  // Keep off unmapped memory, should s0 not hold a frame pointer.
+  base = PGROUNDDOWN(fp - 16);
+  if ((base < KERNBASE || base >= PHYSTOP) && (p == 0 || base != p->kstack))
+    return;
+  while (s->depth < PROF_DEPTH && fp % 16 == 0 && fp - 16 >= base &&
+         fp <= base + PGSIZE) {
+    s->pc[s->depth++] = *(uint64 *)(fp - 8);
+    next = *(uint64 *)(fp - 16);
+    if (next <= fp) break;
+    fp = next;
+  }
+}
+
+// Follow the user frame pointer fp of p, filling s->pc[] from s->depth.
+static void uwalk(struct profsample *s, struct proc *p, uint64 fp) {
+  uint64 pa, next;
+
+  while (s->depth < PROF_DEPTH && fp % 16 == 0 && fp >= 16) {
+    // fp-16 and fp-8 lie on the same page.
+    if ((pa = pgt_getpa(p->uvm->pagetable, PGROUNDDOWN(fp - 16))) == 0)
+      break;
+    pa += (fp - 16) % PGSIZE;
+    s->pc[s->depth++] = *(uint64 *)(pa + 8);
+    next = *(uint64 *)pa;
+    if (next <= fp) break;
+    fp = next;
+  }
+}
+
+// Called by usertrap() and kerneltrap() after a device interrupt,
+// with interrupts off, with the pc and frame pointer it interrupted.
+void prof_intr(int mode, uint64 pc, uint64 fp) {
+  struct profcpu *c = &profcpus[cpuid()];
+  uint64 period = __atomic_load_n(&profperiod, __ATOMIC_RELAXED);
+  struct proc *p = myproc();
+  struct profsample s;
+
+  if (period == 0) return;
+  if (c->due) {
+    c->due = 0;
+    s.pc[0] = pc;
+    s.depth = 1;
+    s.pid = p ? p->pid : 0;
+    s.mode = mode;
+    s.cpu = cpuid();
+    if (mode == PROF_USER)
+      uwalk(&s, p, fp);
+    else
+      kwalk(&s, p, fp);
+
+    acquire(&c->lock);
+    if (c->tail - c->head < NPROFBUF) c->buf[c->tail++ % NPROFBUF] = s;
+    release(&c->lock);
+  }
+  if (!c->armed) {
+    c->armed = 1;
+    timer_add(&c->timer, r_time() + period, prof_due, c);
+  }
+}
+
+// Take hz samples a second on every hart, or none if hz is 0.
+// Returns the previous rate, or -1 if hz is beyond the resolution of
+// the timers; a negative hz leaves the rate as it is.
+int profctl(int hz) {
+  static int rate;
+  int old;
+
+  if (hz > MTIME_FREQ >> TIMER_SHIFT) return -1;
+  old = __atomic_load_n(&rate, __ATOMIC_RELAXED);
+  if (hz < 0) return old;
+  __atomic_store_n(&rate, hz, __ATOMIC_RELAXED);
+  __atomic_store_n(&profperiod, hz ? MTIME_FREQ / hz : 0, __ATOMIC_RELAXED);
+  return old;
+}
+
+// Read as many whole samples as fit in n bytes,
+// oldest first on each hart. Never blocks.
+static int profread(int user_dst, uint64 dst, int n) {
+  struct profsample s;
+  int tot = 0;
+
+  for (int i = 0; i < NCPU; i++) {
+    struct profcpu *c = &profcpus[i];
+    while (n - tot >= sizeof(s)) {
+      acquire(&c->lock);
+      if (c->head == c->tail) {
+        release(&c->lock);
+        break;
+      }
+      s = c->buf[c->head++ % NPROFBUF];
+      release(&c->lock);
+      if (either_copyout(user_dst, dst + tot, &s, sizeof(s)) < 0) return -1;
+      tot += sizeof(s);
+    }
+  }
+  return tot;
+}
+
+static int profwrite(int user_src, uint64 src, int n) { return -1; }
+
+void profinit(void) {
+  for (int i = 0; i < NCPU; i++) initlock(&profcpus[i].lock, "prof");
+  devsw[PROF].read = profread;
+  devsw[PROF].write = profwrite;
+}
@@ -0,0 +1,26 @@
+#ifndef PROF_H_
+#define PROF_H_
+
+#include "types.h"
+
+// Sampling profiler (see prof.c).
+// Profiling is started and stopped with profctl(), and the samples
+// taken on every hart are read from the PROF device (see file.h).
+
+#define PROF_DEPTH 8  // Program counters kept per sample.
+
+// Modes of a sample.
+#define PROF_KERNEL 0
+#define PROF_USER   1
+
+struct profsample {
+  // pc[0] is the interrupted pc, pc[1..depth-1] the return addresses
+  // found following the frame pointers from there, innermost first.
+  uint64 pc[PROF_DEPTH];
+  int pid;      // Process running, or 0 in the scheduler.
+  uchar mode;   // PROF_KERNEL or PROF_USER.
+  uchar depth;  // Entries of pc[] in use.
+  uchar cpu;    // Hart that took it.
+};
+
+#endif
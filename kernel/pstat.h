@@ -1,8 +1,15 @@
 #include "param.h"
+#include "types.h"
 
 struct pstat {
   int inuse[NPROC];
   int tickets[NPROC];
+  int efftickets[NPROC];  // value of the tickets in base tickets
+  int currency[NPROC];    // currency of the tickets, 0 for base
+  int rtprio[NPROC];      // real-time priority, 0 for normal processes
+  uint64 affinity[NPROC]; // harts it may run on, a bit per hart
   int pid[NPROC];
   int ticks[NPROC];
+  uint64 utime[NPROC];    // cycles in user mode
+  uint64 stime[NPROC];    // cycles in the kernel
 };
@@ -265,6 +265,21 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable
+static inline void 
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -274,6 +289,13 @@ r_time()
   return x;
 }
 
+// wait for an interrupt to be pending.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 // enable device interrupts
 static inline void
 intr_on()
@@ -0,0 +1,12 @@
+#ifndef RUSAGE_H_
+#define RUSAGE_H_
+
+#include "types.h"
+
+// Resources used by a process, as reported by wait2().
+struct rusage {
+  uint64 utime;  // Cycles (of MTIME_FREQ Hz) spent in user mode.
+  uint64 stime;  // Cycles spent in the kernel on its behalf.
+};
+
+#endif
@@ -0,0 +1,914 @@
+// Per-CPU run queues.
+//
+// Every hart owns a queue with the RUNNABLE processes waiting for it.
+// scheduler() holds the lottery among the processes of its own queue,
+// so the ticket proportions are kept locally and a process tends to
+// stay on the hart whose caches it has warmed up. The queues of other
+// harts are only touched when the local one is empty (the idle hart
+// steals a process from the busiest queue holding one it may run) and
+// by the periodic rebalance, which moves processes so that every hart
+// carries about the same number of tickets.
+//
+// Two policies decide which queued process runs next. Lottery draws a
+// random ticket, so a process gets its share of the CPU in expectation.
+// Stride gives every process a stride inversely proportional to its
+// tickets and runs the process with the lowest pass, advancing it by
+// its stride; shares are then exact to within one quantum. The queue
+// of each hart is kept ordered by pass while stride is in effect, so
+// choosing is O(1). Passes are maintained under both policies, so the
+// policy can be switched at any time (schedctl(SCHED_POLICY, policy)),
+// and the one in effect at boot is chosen with make SCHEDPOLICY=STRIDE.
+//
+// A process that blocks before its quantum is over has been charged for
+// more than it used. Until it wins again, it holds compensation tickets
+// (Waldspurger): its tickets are inflated by the inverse of the fraction
+// of the quantum it did use, as measured with the cycle counter, so
+// that I/O-bound processes still get their share. Under stride the
+// inflated tickets make its next quantum cheaper instead.
+//
+// Tickets are denominated in a currency (mkcurrency()). A currency is
+// funded with a number of tickets of its parent currency, which are
+// shared out among its members that are not sleeping, in proportion to
+// their tickets; so a group of processes gets its funding as a whole
+// however many members it has, and however many tickets they give
+// themselves. A currency is funded out of the tickets of the process
+// that makes it, which moves into it, so that its parent has no more to
+// share out than before. Only the creator of a currency and its
+// descendants may join it, and only from its parent currency or above:
+// a process never leaves the subtree of currencies it is in, so a job
+// group placed in a currency is capped as a whole. (The base currency
+// is not: a process in it may give itself any number of tickets.) A
+// process blocked waiting on others lends them the value of its tickets
+// (ticket transfer): a reader blocked on an empty pipe to the last
+// writer of the pipe, a parent blocked in wait() to its children. The
+// value of a process, in base tickets, is worked out whenever it is
+// queued, and the queues and draws use it; a change of the funding or
+// membership of a currency reaches the other queued members when they
+// are queued again, a quantum later at most.
+//
+// Real-time processes (sched_setattr() with SCHED_FIFO) are kept in a
+// queue of their own on each hart, by priority, and always run before
+// the lottery or stride is held among the normal ones; a running one
+// is only preempted by one of a higher priority, which kicks its hart
+// as soon as it is queued. One that wakes up to find its hart busy
+// with the same or a higher priority is queued on a hart running
+// something of a lower one instead, if it may use any. So that they
+// cannot starve the others, the real-time processes of a hart may only
+// take up rt_budget percent of each period of RT_PERIOD ticks while
+// normal ones are waiting for it (schedctl(SCHED_RTBUDGET, percent));
+// the queues do not count them in their tickets, and only the idle
+// harts stealing work move them.
+//
+// Fairness across harts: let T be the total number of tickets of the
+// runnable processes, H the number of harts and M the largest ticket
+// count of a single process. Right after a rebalance the load (queued
+// plus running tickets) of every hart is within M of T/H, so a process
+// with t tickets gets a fraction of the machine that differs from its
+// global share t/T by a relative error of at most H*M/T. Between
+// rebalances the error grows only with the processes that block or
+// exit, and is corrected at the next rebalance; a shorter interval
+// (schedctl(SCHED_REBALANCE, n)) trades lock traffic for accuracy.
+//
+// A process may be restricted to some harts (sched_setaffinity()). It
+// is only ever queued on one of them, and neither stealing nor the
+// rebalance moves it to any other.
+//
+// A hart with nothing to run, not even to steal, waits in wfi instead
+// of polling the queues of the others. Whoever queues a process kicks
+// an idle hart out of it with an IPI: the hart the process was queued
+// on, or otherwise any idle hart, which will then steal it. Likewise
+// for a hart that has stopped its clock tick because it had no one
+// else to run (see timer.c), which must tick again to preempt its
+// process. The rebalance is run by whichever hart ticks first once it
+// is due.
+//
+// Locking: p->lock is acquired before rq->lock. When two run queues
+// are held at once, the one of the lowest-numbered hart goes first.
+// A process is taken off its queue by the hart that is going to run
+// it, which from then on is the only one allowed to switch to it.
+
+#include "defs.h"
+#include "memlayout.h"
+#include "param.h"
+#include "proc.h"
+#include "riscv.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "types.h"
+
+#ifndef SCHEDPOLICY
+#define SCHEDPOLICY SCHED_LOTTERY
+#endif
+
+// Pass advanced by a process with a single ticket per quantum.
+#define STRIDE1 (1 << 20)
+
+// Compensation factors are fixed point, with COMP_ONE meaning 1.
+// COMP_MAX is the largest factor tickets are inflated by.
+#define COMP_ONE 16
+#define COMP_MAX 10
+
+// Currencies, in use while they have members or subcurrencies.
+// currency_lock protects ref; active is updated atomically.
+struct currency {
+  int ref;                    // Member processes and subcurrencies.
+  int funding;                // Tickets of parent backing the currency.
+  int active;                 // Tickets of the members not sleeping.
+  struct currency *parent;    // Currency funding it, 0 for base.
+  struct proc *creator;       // Process that made it, while it is
+  int creatorpid;             // still the process creatorpid.
+} currencies[NCURRENCY];
+struct spinlock currency_lock;
+
+// Held while lending tickets, and while resetting the tickets
+// lent to a process that is freed.
+struct spinlock transfer_lock;
+
+int rebalance_interval = REBALANCE_TICKS;
+int sched_policy = SCHEDPOLICY;
+int sched_direct = 1;
+int rt_budget = RT_BUDGET;
+
+// mtime of the next rebalance.
+uint64 nextrebalance;
+
+void runqinit(void) {
+  initlock(&currency_lock, "currency");
+  initlock(&transfer_lock, "transfer");
+  for (struct cpu *c = cpus; c < &cpus[NCPU]; c++) {
+    initlock(&c->rq.lock, "runq");
+    c->rq.head = c->rq.tail = 0;
+    c->rq.rthead = c->rq.rttail = 0;
+    c->rq.nproc = c->rq.nrt = 0;
+    c->rq.tickets = 0;
+    c->rq.pass = 0;
+  }
+}
+
+// Value of p's tickets in base tickets, with those lent to it:
+// converted into the currency funding each of its currencies in turn.
+int tickets_value(struct proc *p) {
+  struct currency *cur;
+  uint64 v = p->tickets;
+  int active;
+
+  for (cur = p->currency; cur; cur = cur->parent) {
+    if ((active = cur->active) > 0) v = v * cur->funding / active;
+    if (v > 0x7fffffff) v = 0x7fffffff;
+  }
+  if (v < 1) v = 1;
+  return v + p->lent;
+}
+
+// Link p after q in the list from *head to *tail, or at its head
+// if q is 0.
+static void runq_link(struct proc **head, struct proc **tail,
+                      struct proc *q, struct proc *p) {
+  p->rqprev = q;
+  p->rqnext = q ? q->rqnext : *head;
+  if (p->rqnext)
+    p->rqnext->rqprev = p;
+  else
+    *tail = p;
+  if (q)
+    q->rqnext = p;
+  else
+    *head = p;
+}
+
+// Unlink p from the list from *head to *tail.
+static void runq_unlink(struct proc **head, struct proc **tail,
+                        struct proc *p) {
+  if (p->rqprev)
+    p->rqprev->rqnext = p->rqnext;
+  else
+    *head = p->rqnext;
+  if (p->rqnext)
+    p->rqnext->rqprev = p->rqprev;
+  else
+    *tail = p->rqprev;
+  p->rqnext = p->rqprev = 0;
+}
+
+// Add p to rq: in pass order under stride, at the tail otherwise.
+// A process that has been away (sleeping) does not keep the credit it
+// would have accumulated: its pass is brought up to that of the queue.
+// A real-time process goes behind those of the same or a higher
+// priority instead.
+// Caller must hold rq->lock.
+static void runq_insert(struct runq *rq, struct proc *p) {
+  struct proc *q;
+  uint64 eff;
+
+  eff = tickets_value(p);
+  if (p->comp) eff = eff * p->comp / COMP_ONE;
+  p->efftickets = eff > 0x7fffffff ? 0x7fffffff : eff;
+  rq->nproc++;
+  if (p->rtprio) {
+    q = rq->rttail;
+    while (q && q->rtprio < p->rtprio) q = q->rqprev;
+    runq_link(&rq->rthead, &rq->rttail, q, p);
+    rq->nrt++;
+    return;
+  }
+
+  if (p->pass < rq->pass) p->pass = rq->pass;
+  q = rq->tail;
+  if (sched_policy == SCHED_STRIDE) {
+    // Equal passes are served in FIFO order.
+    while (q && q->pass > p->pass) q = q->rqprev;
+  }
+  runq_link(&rq->head, &rq->tail, q, p);
+  rq->tickets += p->efftickets;
+}
+
+// Unlink p from rq.
+// Caller must hold rq->lock.
+static void runq_remove(struct runq *rq, struct proc *p) {
+  rq->nproc--;
+  if (p->rtprio) {
+    runq_unlink(&rq->rthead, &rq->rttail, p);
+    rq->nrt--;
+    return;
+  }
+  runq_unlink(&rq->head, &rq->tail, p);
+  rq->tickets -= p->efftickets;
+}
+
+// Is p in rq?
+// Caller must hold rq->lock.
+static int runq_queued(struct runq *rq, struct proc *p) {
+  return p->rqprev != 0 || rq->head == p || rq->rthead == p;
+}
+
+// Move p, which has been removed from the queue from,
+// to the time frame of the queue to, keeping its lag.
+static void runq_migrate(struct runq *from, struct runq *to, struct proc *p) {
+  p->pass = to->pass + (p->pass - from->pass);
+}
+
+// Hold a lottery among the processes of rq, and cur if not 0,
+// and return the winner, or 0 if there is none. It is not dequeued.
+// Caller must hold rq->lock.
+static struct proc *runq_draw(struct runq *rq, struct proc *cur,
+                              struct rng *rng) {
+  struct proc *p;
+  int winner_ticket, total;
+
+  total = rq->tickets + (cur ? cur->efftickets : 0);
+  if (total == 0) return 0;
+  winner_ticket = rand(rng) % total;
+  for (p = rq->head; p; p = p->rqnext) {
+    if (winner_ticket < p->efftickets) break;
+    winner_ticket -= p->efftickets;
+  }
+  return p ? p : cur;
+}
+
+// Have the real-time processes run on c used up their budget for the
+// current period? Only c itself, with interrupts off, uses the period.
+static int rt_throttled(struct cpu *c) {
+  uint64 now = r_time();
+
+  if (now >= c->rtperiod) {
+    c->rtperiod = now + (uint64)RT_PERIOD * TICK_CYCLES;
+    c->rtused = 0;
+  }
+  return rt_budget < 100 &&
+         c->rtused >= (uint64)RT_PERIOD * TICK_CYCLES / 100 * rt_budget;
+}
+
+// Choose the process of rq, or cur if not 0, that c should run next,
+// or 0 if there is none. It is not dequeued.
+// Caller must hold rq->lock.
+static struct proc *runq_next(struct runq *rq, struct proc *cur,
+                              struct cpu *c) {
+  struct proc *p, *rt = rq->rthead;
+
+  // The real-time process of highest priority, unless it is over
+  // budget and there are others. cur would go in front of the
+  // processes of its priority: a FIFO process preempted by the tick
+  // runs on.
+  if (cur && cur->rtprio) {
+    if (rt == 0 || cur->rtprio >= rt->rtprio) rt = cur;
+    cur = 0;
+  }
+  if (rt && ((rq->head == 0 && cur == 0) || !rt_throttled(c))) return rt;
+
+  if (sched_policy == SCHED_STRIDE) {
+    // cur would be queued after the processes with the same pass.
+    p = rq->head;
+    return cur && (p == 0 || cur->pass < p->pass) ? cur : p;
+  }
+  return runq_draw(rq, cur, &c->rng);
+}
+
+// Charge p, which has been chosen to run next, a quantum.
+// Its compensation tickets make the quantum cheaper, and are
+// used up now that it has won.
+// Caller must hold the lock of the queue p was taken from.
+static void runq_charge(struct runq *rq, struct proc *p) {
+  if (p->rtprio) return;
+  rq->pass = p->pass;
+  p->pass += STRIDE1 / p->efftickets;
+  p->comp = 0;
+  p->efftickets = tickets_value(p);
+}
+
+// Add n tickets to the active amount of cur. The funding of a
+// currency only counts in its parent while it has active members.
+// Two harts changing the same currency may leave a parent off for a
+// moment; tickets_value() copes with any amount.
+static void currency_add(struct currency *cur, int n) {
+  int old, new;
+
+  for (; cur; cur = cur->parent) {
+    old = __sync_fetch_and_add(&cur->active, n);
+    new = old + n;
+    if ((old > 0) == (new > 0)) break;
+    n = new > 0 ? cur->funding : -cur->funding;
+  }
+}
+
+// Count p's tickets in the active amount of its currency, or not.
+// Caller must hold p->lock.
+static void currency_active(struct proc *p, int active) {
+  if (p->active == active) return;
+  p->active = active;
+  if (p->currency) currency_add(p->currency, active ? p->tickets : -p->tickets);
+}
+
+// p, taken by runq_pick() and run for used cycles, has given up the cpu.
+// If it blocked, give it compensation tickets for the rest of its
+// quantum (a clock tick); in any case, a process that sleeps or exits
+// no longer draws on the funding of its currency.
+// A real-time process spends the budget of the cpu instead.
+// Caller must hold p->lock.
+void runq_done(struct proc *p, uint64 used) {
+  if (p->rtprio) mycpu()->rtused += used;
+  if (p->state == RUNNABLE) return;
+  currency_active(p, 0);
+  if (p->state == ZOMBIE) currency_leave(p);
+  if (p->state != SLEEPING || used >= TICK_CYCLES) return;
+  if (used < TICK_CYCLES / COMP_MAX) used = TICK_CYCLES / COMP_MAX;
+  p->comp = COMP_ONE * TICK_CYCLES / used;
+}
+
+// May p run on c?
+static int cpu_allowed(struct proc *p, struct cpu *c) {
+  return p->affinity >> (c - cpus) & 1;
+}
+
+// Tickets a cpu is in charge of: those of its queue and of the
+// process it is running. Read without locks; only used as a hint.
+static int cpuload(struct cpu *c) {
+  struct proc *p = c->proc;
+  return c->rq.tickets + (p ? p->efftickets : 0);
+}
+
+// Real-time priority of what c is running: -1 if nothing, 0 for a
+// normal process. Read without locks; only used as a hint.
+static int cpu_rtprio(struct cpu *c) {
+  struct proc *p = c->proc;
+  return p ? p->rtprio : -1;
+}
+
+// c is busy with a process of the same or a higher priority than the
+// real-time p. Find a hart p may use that runs something of a lower
+// priority, the lowest there is, and with the fewest real-time
+// processes queued; or keep c if there is none.
+static struct cpu *runq_rttarget(struct proc *p, struct cpu *c) {
+  struct cpu *best = 0, *v;
+  int prio;
+
+  for (v = cpus; v < &cpus[NCPU]; v++) {
+    if (!v->online || !cpu_allowed(p, v)) continue;
+    if ((prio = cpu_rtprio(v)) >= p->rtprio) continue;
+    if (best == 0 || prio < cpu_rtprio(best) ||
+        (prio == cpu_rtprio(best) && v->rq.nrt < best->rq.nrt))
+      best = v;
+  }
+  return best ? best : c;
+}
+
+// Pick the run queue for a process that has just become runnable:
+// the one it last used, so that it finds its caches warm,
+// or the least loaded one it may use if it never ran there.
+// A real-time process goes elsewhere rather than wait behind one of
+// the same or a higher priority.
+static struct cpu *runq_target(struct proc *p) {
+  struct cpu *c, *best = 0;
+
+  if (p->cpu >= 0 && cpus[p->cpu].online && cpu_allowed(p, &cpus[p->cpu])) {
+    best = &cpus[p->cpu];
+  } else {
+    for (c = cpus; c < &cpus[NCPU]; c++) {
+      if (c->online && cpu_allowed(p, c) &&
+          (best == 0 || cpuload(c) < cpuload(best)))
+        best = c;
+    }
+    if (best == 0) return mycpu();
+  }
+  if (p->rtprio && cpu_rtprio(best) >= p->rtprio)
+    best = runq_rttarget(p, best);
+  return best;
+}
+
+// Send an IPI to c, to get it out of wfi or have it look at
+// requests from other cpus (see devintr()).
+void cpu_kick(struct cpu *c) {
+  *(uint32 *)CLINT_MSIP(c - cpus) = 1;
+}
+
+// Mark p RUNNABLE and queue it.
+// Caller must hold p->lock.
+void runq_add(struct proc *p) {
+  struct cpu *c, *idle;
+  struct proc *q;
+
+  if (!holding(&p->lock)) panic("runq_add");
+  p->state = RUNNABLE;
+  currency_active(p, 1);
+  c = runq_target(p);
+  acquire(&c->rq.lock);
+  p->cpu = c - cpus;
+  runq_insert(&c->rq, p);
+  release(&c->rq.lock);
+
+  // Pairs with the fences in runq_idle() and tick_update(): either we
+  // see the hart idle (or tickless), or it sees p queued.
+  __sync_synchronize();
+  if (c->idle) {
+    cpu_kick(c);
+    return;
+  }
+  // A real-time process preempts one of a lower priority right away,
+  // not at the next tick. c->proc is only a hint, as c may be switching.
+  q = c->proc;
+  if (p->rtprio && q && q != p && q->rtprio < p->rtprio) {
+    __atomic_store_n(&c->resched, 1, __ATOMIC_RELEASE);
+    cpu_kick(c);
+  } else if (c->tickless) {
+    cpu_kick(c);
+  }
+  // p will have to wait for c; let an idle hart steal it instead.
+  // A process that yields is next in line already.
+  if (c->rq.nproc <= 1 && (c->proc == 0 || c->proc == p)) return;
+  for (idle = cpus; idle < &cpus[NCPU]; idle++) {
+    if (idle->online && idle->idle && cpu_allowed(p, idle)) {
+      cpu_kick(idle);
+      return;
+    }
+  }
+}
+
+// The first process of rq that may run on c, real-time ones first,
+// or 0 if there is none.
+// Caller must hold rq->lock.
+static struct proc *runq_firstfor(struct runq *rq, struct cpu *c) {
+  struct proc *p;
+
+  for (p = rq->rthead; p; p = p->rqnext) {
+    if (cpu_allowed(p, c)) return p;
+  }
+  for (p = rq->head; p; p = p->rqnext) {
+    if (cpu_allowed(p, c)) return p;
+  }
+  return 0;
+}
+
+// Take a process from the busiest run queue on behalf of the idle c,
+// among those holding one that may run on c. It is the one that would
+// run next there, if it may run on c.
+static struct proc *runq_steal(struct cpu *c) {
+  struct cpu *victim, *v;
+  struct proc *p;
+  uint64 tried = 0;
+
+  for (;;) {
+    victim = 0;
+    for (v = cpus; v < &cpus[NCPU]; v++) {
+      if (v != c && v->online && v->rq.nproc > 0 &&
+          !(tried >> (v - cpus) & 1) &&
+          (victim == 0 || v->rq.nproc > victim->rq.nproc))
+        victim = v;
+    }
+    if (victim == 0) return 0;
+    tried |= 1ull << (victim - cpus);
+
+    acquire(&victim->rq.lock);
+    p = runq_next(&victim->rq, 0, c);
+    if (p && !cpu_allowed(p, c)) p = runq_firstfor(&victim->rq, c);
+    if (p) {
+      runq_remove(&victim->rq, p);
+      runq_charge(&victim->rq, p);
+      runq_migrate(&victim->rq, &c->rq, p);
+    }
+    release(&victim->rq.lock);
+    if (p) return p;
+  }
+}
+
+// Choose the next process to run on c and take it off its queue.
+// cur, if not 0, is a process yielding c: it is not queued, but takes
+// part in the choice as if it were, and is returned if it wins.
+// Returns 0 if there is nothing to run.
+struct proc *runq_pick(struct cpu *c, struct proc *cur) {
+  struct proc *p;
+
+  // cur may just have been barred from c.
+  if (cur && !cpu_allowed(cur, c)) cur = 0;
+
+  acquire(&c->rq.lock);
+  if ((p = runq_next(&c->rq, cur, c)) != 0) {
+    if (p != cur) runq_remove(&c->rq, p);
+    runq_charge(&c->rq, p);
+  }
+  release(&c->rq.lock);
+  if (p == 0) p = runq_steal(c);
+  return p;
+}
+
+// Is there a queued process that c could run or steal? Processes
+// that may not run on c do not count, or an idle hart would keep
+// waking up for them.
+static int runq_work(struct cpu *c) {
+  int found;
+
+  for (struct cpu *v = cpus; v < &cpus[NCPU]; v++) {
+    if (!v->online || v->rq.nproc == 0) continue;
+    if (v == c) return 1;
+    acquire(&v->rq.lock);
+    found = runq_firstfor(&v->rq, c) != 0;
+    release(&v->rq.lock);
+    if (found) return 1;
+  }
+  return 0;
+}
+
+// Wait in wfi until there may be work for c,
+// accounting the time spent in c->idletime.
+void runq_idle(struct cpu *c) {
+  uint64 start;
+
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  if (!runq_work(c)) {
+    start = r_time();
+    wfi();
+    c->idletime += r_time() - start;
+  }
+  c->idle = 0;
+  intr_on();
+}
+
+// Move queued processes from the more loaded cpu to the less loaded
+// one, as long as each move narrows the gap between them.
+// Returns the number of processes moved.
+static int runq_balancepair(struct cpu *from, struct cpu *to) {
+  struct cpu *first = from < to ? from : to;
+  struct cpu *second = from < to ? to : from;
+  struct proc *p, *best;
+  int gap, left, bestleft, moved = 0;
+
+  acquire(&first->rq.lock);
+  acquire(&second->rq.lock);
+  gap = cpuload(from) - cpuload(to);
+  for (;;) {
+    // Moving a process with t tickets leaves a gap of |gap - 2t|,
+    // which only improves things if t < gap.
+    best = 0;
+    bestleft = gap;
+    for (p = from->rq.head; p; p = p->rqnext) {
+      if (!cpu_allowed(p, to)) continue;
+      left = gap - 2 * p->efftickets;
+      if (left < 0) left = -left;
+      if (left < bestleft) {
+        best = p;
+        bestleft = left;
+      }
+    }
+    if (best == 0) break;
+    runq_remove(&from->rq, best);
+    runq_migrate(&from->rq, &to->rq, best);
+    best->cpu = to - cpus;
+    runq_insert(&to->rq, best);
+    gap -= 2 * best->efftickets;
+    moved++;
+  }
+  release(&second->rq.lock);
+  release(&first->rq.lock);
+  // Pairs with the fence in tick_update().
+  __sync_synchronize();
+  if (moved > 0 && to->tickless) cpu_kick(to);
+  return moved;
+}
+
+// Even out the ticket load of the harts.
+static void runq_rebalance(void) {
+  struct cpu *c, *max, *min;
+
+  for (int i = 0; i < NCPU; i++) {
+    max = min = 0;
+    for (c = cpus; c < &cpus[NCPU]; c++) {
+      if (!c->online) continue;
+      if (max == 0 || cpuload(c) > cpuload(max)) max = c;
+      if (min == 0 || cpuload(c) < cpuload(min)) min = c;
+    }
+    if (max == min || runq_balancepair(max, min) == 0) break;
+  }
+}
+
+// Called on every clock tick of every hart:
+// rebalance once every rebalance_interval ticks.
+void runq_tick(void) {
+  uint64 now = r_time(), next = nextrebalance;
+
+  if (rebalance_interval == 0 || now < next) return;
+  // Only one of the harts ticking at the same time does it.
+  if (!__sync_bool_compare_and_swap(
+          &nextrebalance, next,
+          now + (uint64)rebalance_interval * TICK_CYCLES))
+    return;
+  runq_rebalance();
+}
+
+// Switch to policy, reordering the queues of normal processes
+// if needed.
+static void runq_setpolicy(int policy) {
+  struct cpu *c;
+  struct proc *p, *next;
+
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    acquire(&c->rq.lock);
+    sched_policy = policy;
+    p = c->rq.head;
+    c->rq.head = c->rq.tail = 0;
+    c->rq.nproc = c->rq.nrt;
+    c->rq.tickets = 0;
+    for (; p; p = next) {
+      next = p->rqnext;
+      runq_insert(&c->rq, p);
+    }
+    release(&c->rq.lock);
+  }
+}
+
+// Change a setting of the scheduler.
+// Returns the previous value, or -1 on error.
+int schedctl(int op, int val) {
+  int old;
+
+  switch (op) {
+    case SCHED_REBALANCE:
+      if (val < 0) return -1;
+      old = rebalance_interval;
+      rebalance_interval = val;
+      return old;
+    case SCHED_POLICY:
+      if (val != SCHED_LOTTERY && val != SCHED_STRIDE) return -1;
+      old = sched_policy;
+      if (val != old) runq_setpolicy(val);
+      return old;
+    case SCHED_DIRECT:
+      if (val != 0 && val != 1) return -1;
+      old = sched_direct;
+      sched_direct = val;
+      return old;
+    case SCHED_RTBUDGET:
+      if (val < 0 || val > 100) return -1;
+      old = rt_budget;
+      rt_budget = val;
+      return old;
+  }
+  return -1;
+}
+
+// Lock the run queue of the RUNNABLE p, which the rebalance may
+// change meanwhile, and return its cpu. p may also have been picked
+// from it, and be about to run.
+// Caller must hold p->lock.
+static struct cpu *runq_lockof(struct proc *p) {
+  struct cpu *c;
+
+  for (;;) {
+    c = &cpus[p->cpu];
+    acquire(&c->rq.lock);
+    if (c == &cpus[p->cpu]) return c;
+    release(&c->rq.lock);
+  }
+}
+
+// Make p a real-time process of priority prio, or a normal one if prio
+// is 0, moving it to the right queue if it is queued.
+// Caller must hold p->lock.
+void runq_setprio(struct proc *p, int prio) {
+  struct cpu *c;
+
+  if (p->state != RUNNABLE) {
+    p->rtprio = prio;
+    return;
+  }
+  c = runq_lockof(p);
+  if (runq_queued(&c->rq, p)) {
+    runq_remove(&c->rq, p);
+    p->rtprio = prio;
+    runq_insert(&c->rq, p);
+  } else {
+    p->rtprio = prio;
+  }
+  release(&c->rq.lock);
+}
+
+// Restrict p to the harts in mask, moving it to another queue if it is
+// queued on a hart it may no longer use, or preempting it if it runs
+// on one. A process already picked still runs once where it was.
+// Caller must hold p->lock.
+void runq_setaffinity(struct proc *p, uint64 mask) {
+  struct cpu *c;
+
+  if (p->state != RUNNABLE) {
+    p->affinity = mask;
+    if (p->state == RUNNING && !cpu_allowed(p, &cpus[p->cpu]) &&
+        p != myproc()) {
+      c = &cpus[p->cpu];
+      __atomic_store_n(&c->resched, 1, __ATOMIC_RELEASE);
+      cpu_kick(c);
+    }
+    return;
+  }
+  c = runq_lockof(p);
+  p->affinity = mask;
+  if (runq_queued(&c->rq, p) && !cpu_allowed(p, c)) {
+    runq_remove(&c->rq, p);
+    release(&c->rq.lock);
+    runq_add(p);
+    return;
+  }
+  release(&c->rq.lock);
+}
+
+// Drop a reference to cur, and the one it holds on its parent
+// once it has no members left.
+// Caller must hold currency_lock.
+static void currency_put(struct currency *cur) {
+  for (; cur && --cur->ref == 0; cur = cur->parent)
+    ;
+}
+
+// Make p a member of cur (0 is the base currency).
+// p must not be active, nor a member of another currency.
+void currency_join(struct proc *p, struct currency *cur) {
+  if (p->active || p->currency) panic("currency_join");
+  if (cur) {
+    acquire(&currency_lock);
+    cur->ref++;
+    release(&currency_lock);
+  }
+  p->currency = cur;
+}
+
+// Take p, which must not be active, out of its currency.
+void currency_leave(struct proc *p) {
+  if (p->active) panic("currency_leave");
+  if (p->currency) {
+    acquire(&currency_lock);
+    currency_put(p->currency);
+    release(&currency_lock);
+    p->currency = 0;
+  }
+}
+
+// Id of the currency of p, 0 being the base one.
+int currencyof(struct proc *p) {
+  return p->currency ? p->currency - currencies + 1 : 0;
+}
+
+// Is p the creator of cur, or one of its descendants?
+// Pids only grow, so a parent has a lower pid than its children, and
+// a parent found to have a higher one has been reused meanwhile.
+static int currency_creatorof(struct currency *cur, struct proc *p) {
+  struct proc *pp;
+  int pid = p->pid, ppid;
+
+  for (;;) {
+    if (p == cur->creator && pid == cur->creatorpid) return 1;
+    pp = __atomic_load_n(&p->parent, __ATOMIC_ACQUIRE);
+    if (pp == 0 || (ppid = pp->pid) <= 0 || ppid >= pid) return 0;
+    p = pp;
+    pid = ppid;
+  }
+}
+
+// May p move into cur? Only within the currency it is in: to cur
+// itself, or to a subcurrency made by p or one of its ancestors.
+// Caller must hold currency_lock.
+static int currency_mayjoin(struct proc *p, struct currency *cur) {
+  struct currency *c;
+
+  if (cur == p->currency) return 1;
+  if (cur == 0 || cur->ref == 0 || !currency_creatorof(cur, p)) return 0;
+  for (c = cur->parent; c; c = c->parent) {
+    if (c == p->currency) return 1;
+  }
+  return p->currency == 0;
+}
+
+// Move the calling process to the currency id, 0 being the base one.
+// Returns the previous currency, or -1 on error.
+int setcurrency(int id) {
+  struct proc *p = myproc();
+  struct currency *cur = 0;
+  int old;
+
+  if (id < 0 || id > NCURRENCY) return -1;
+  acquire(&p->lock);
+  if (id > 0) cur = &currencies[id - 1];
+  acquire(&currency_lock);
+  // The currency may also have lost its last member.
+  if (!currency_mayjoin(p, cur)) {
+    release(&currency_lock);
+    release(&p->lock);
+    return -1;
+  }
+  if (cur) cur->ref++;
+  release(&currency_lock);
+  old = currencyof(p);
+  currency_active(p, 0);
+  currency_leave(p);
+  p->currency = cur;
+  currency_active(p, 1);
+  p->efftickets = tickets_value(p);
+  release(&p->lock);
+  return old;
+}
+
+// Create a subcurrency of the currency of the calling process, backed
+// by funding of its tickets, and move the process to it. It keeps its
+// tickets, now in the new currency: the parent currency has the
+// funding to share out instead, never more than it had before.
+// Returns the id of the currency, or -1 if none is left or the
+// process does not have funding tickets.
+int mkcurrency(int funding) {
+  struct proc *p = myproc();
+  struct currency *cur;
+
+  if (funding < 1 || funding > p->tickets) return -1;
+  acquire(&currency_lock);
+  for (cur = currencies; cur < &currencies[NCURRENCY]; cur++) {
+    if (cur->ref == 0) break;
+  }
+  if (cur == &currencies[NCURRENCY]) {
+    release(&currency_lock);
+    return -1;
+  }
+  // Hold it until the caller is in.
+  cur->ref = 1;
+  cur->funding = funding;
+  cur->active = 0;
+  cur->parent = p->currency;
+  if (cur->parent) cur->parent->ref++;
+  cur->creator = p;
+  cur->creatorpid = p->pid;
+  release(&currency_lock);
+
+  setcurrency(cur - currencies + 1);
+  acquire(&currency_lock);
+  currency_put(cur);
+  release(&currency_lock);
+  return cur - currencies + 1;
+}
+
+// Set the tickets of the calling process, in its currency.
+int settickets(int n) {
+  struct proc *p = myproc();
+
+  if (n < 1) return -1;
+  acquire(&p->lock);
+  currency_active(p, 0);
+  p->tickets = n;
+  currency_active(p, 1);
+  p->efftickets = tickets_value(p);
+  release(&p->lock);
+  return 0;
+}
+
+// Lend n base tickets to p, as long as it is still the process pid
+// (take them back if n is negative).
+void tickets_lend(struct proc *p, int pid, int n) {
+  acquire(&transfer_lock);
+  if (p->pid == pid) {
+    p->lent += n;
+    if (p->lent < 0) p->lent = 0;
+  }
+  release(&transfer_lock);
+}
+
+// Forget the tickets lent to p, which is being freed
+// and no longer has a pid.
+void tickets_reset(struct proc *p) {
+  acquire(&transfer_lock);
+  p->lent = 0;
+  release(&transfer_lock);
+}
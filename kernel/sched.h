@@ -0,0 +1,42 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+// Operations of the schedctl() system call.
+// Each one returns the previous value of the setting, or -1 on error.
+
+// Interval, in ticks, between rebalances of the per-CPU run queues.
+// 0 disables the periodic rebalance (idle harts still steal work).
+#define SCHED_REBALANCE 1
+// Scheduling policy, one of the SCHED_LOTTERY, SCHED_STRIDE below.
+#define SCHED_POLICY    2
+// Whether a process giving up the CPU switches directly to the next
+// one (1, the default) or goes through the scheduler thread (0).
+#define SCHED_DIRECT    3
+// Percentage of the CPU time of a hart, over periods of RT_PERIOD
+// ticks, that real-time processes may take while others are waiting
+// for it. 100 lets them starve the others.
+#define SCHED_RTBUDGET  4
+
+// Scheduling policies. Both share out the CPU in proportion to the
+// tickets of each process (see settickets()): lottery does it in
+// expectation, stride deterministically.
+#define SCHED_LOTTERY   0
+#define SCHED_STRIDE    1
+
+// Scheduling classes of a process, set with sched_setattr().
+// Normal processes share out the CPU by their tickets, under the
+// policy above. Real-time (FIFO) processes run before any of them,
+// highest priority first and first come, first served among equals,
+// until they block or one of a higher priority becomes runnable.
+#define SCHED_NORMAL    0
+#define SCHED_FIFO      1
+
+// Real-time priorities go from 1 to RTPRIO_MAX.
+#define RTPRIO_MAX      99
+
+struct sched_attr {
+  int policy;    // SCHED_NORMAL or SCHED_FIFO.
+  int priority;  // Real-time priority under SCHED_FIFO, otherwise 0.
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SCSTAT_H_
+#define SCSTAT_H_
+
+#include "types.h"
+
+// System call statistics, kept for every process and every hart
+// and read with getscstat(), or with waitscstat() when reaping a
+// child.
+
+#define NSYSCALL 48  // Above the highest system call number.
+#define NSCHIST  16  // Buckets of the latency histograms.
+
+// What getscstat(kind, id, st) reports on.
+#define SCSTAT_PROC 0  // The process id, or the caller if id is 0.
+#define SCSTAT_CPU  1  // The hart id.
+
+struct scstat {
+  uint64 count[NSYSCALL];   // Calls made.
+  uint64 cycles[NSYSCALL];  // mtime cycles spent in them, all told.
+  // Calls that took 2^i to 2^(i+1)-1 cycles are counted in bucket i
+  // (and those of 0 cycles in bucket 0), longer ones in the last one.
+  uint hist[NSYSCALL][NSCHIST];
+};
+
+#endif
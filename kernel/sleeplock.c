@@ -1,4 +1,17 @@
 // Sleeping locks
+//
+// A sleep lock is held by one process at a time, or shared by any
+// number of readers. Writers come first: once one waits for the lock,
+// new readers wait too, so that a stream of readers cannot starve it.
+// Writers sleep on the lock and readers on lk->readers, so that the
+// last reader out only wakes up a writer.
+//
+// Critical sections under a sleep lock are often short, and going to
+// sleep and being woken up costs two context switches. So a writer
+// finding the lock held by a process running on another hart first
+// spins, for up to SLEEPSPIN cycles, in the hope that it lets go soon;
+// it only sleeps if the owner stops running, or takes too long. The
+// harts count the locks so got, and the sleeps (see getcpuinfo()).
 
 #include "types.h"
 #include "riscv.h"
@@ -15,17 +28,51 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
   lk->pid = 0;
+  lk->owner = 0;
+}
+
+// Wait while owner holds lk and runs, for up to SLEEPSPIN cycles.
+static void
+spinowner(struct sleeplock *lk, struct proc *owner)
+{
+  uint64 end = r_time() + SLEEPSPIN;
+
+  while (__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) == owner &&
+         __atomic_load_n(&owner->state, __ATOMIC_RELAXED) == RUNNING &&
+         r_time() < end)
+    ;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *owner;
+  int spun = 0, slept = 0;
+
   acquire(&lk->lk);
-  while (lk->locked) {
+  while (lk->locked || lk->readers) {
+    // We run here, so a RUNNING owner runs on another hart.
+    owner = lk->owner;
+    if (!spun && owner && owner->state == RUNNING) {
+      spun = 1;
+      release(&lk->lk);
+      spinowner(lk, owner);
+      acquire(&lk->lk);
+      continue;
+    }
+    slept = 1;
+    mycpu()->slsleeps++;
+    lk->wwait++;
     sleep(lk, &lk->lk);
+    lk->wwait--;
   }
+  if (spun && !slept)
+    mycpu()->slspins++;
   lk->locked = 1;
+  lk->owner = myproc();
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
@@ -35,8 +82,34 @@ releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
-  wakeup(lk);
+  if (lk->wwait)
+    wakeup_one(lk);
+  else
+    wakeup(&lk->readers);
+  release(&lk->lk);
+}
+
+void
+acquiresleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->wwait) {
+    sleep(&lk->readers, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+releasesleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if (lk->readers < 1)
+    panic("releasesleep_shared");
+  if (--lk->readers == 0 && lk->wwait)
+    wakeup_one(lk);
   release(&lk->lk);
 }
 
@@ -46,7 +119,7 @@ holdingsleep(struct sleeplock *lk)
   int r;
   
   acquire(&lk->lk);
-  r = lk->locked && (lk->pid == myproc()->pid);
+  r = lk->locked && lk->owner == myproc();
   release(&lk->lk);
   return r;
 }
@@ -1,14 +1,20 @@
 #ifndef SLEEPLOCK_H_
 #define SLEEPLOCK_H_
 
-// Long-term locks for processes
+// Long-term locks for processes.
+// Held either by one process (acquiresleep()) or shared by any number
+// of readers (acquiresleep_shared()).
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Processes sharing the lock.
+  int wwait;         // Processes waiting to hold it exclusively.
   struct spinlock lk; // spinlock protecting this sleep lock
   
+  struct proc *owner; // Process holding lock exclusively, or null
+
   // For debugging:
   char *name;        // Name of lock.
-  int pid;           // Process holding lock
+  int pid;           // Process holding lock exclusively
 };
 
 #endif
@@ -1,4 +1,19 @@
 // Mutual exclusion spin locks.
+//
+// A lock from initlock() is a test-and-test-and-set lock: a waiting
+// cpu spins reading the lock word, which stays in its cache, and only
+// tries the atomic swap once it sees the lock free. Cheap, but the
+// lock goes to whichever cpu swaps first when it is released, and all
+// the waiters then miss on the same cache line.
+//
+// A lock from initmcslock() is an MCS queue lock, for the global locks
+// that many cpus fight over. Waiting cpus queue up behind lk->tail,
+// each spinning on a node of its own, and the holder hands the lock
+// to the next one in the queue when it releases it: first come, first
+// served, and a release only disturbs the cache of the next holder.
+// A cpu takes a node from its own NMCS for each MCS lock it holds or
+// waits for; interrupts are off meanwhile, so nobody else on the cpu
+// can touch them.
 
 #include "types.h"
 #include "param.h"
@@ -8,13 +23,89 @@
 #include "proc.h"
 #include "defs.h"
 
+static struct mcsnode mcsnodes[NCPU][NMCS];
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->mcs = 0;
+  lk->tail = 0;
+  lk->owner = 0;
+#ifdef LOCKSTAT
+  lk->stat = 0;
+#endif
+}
+
+// Built with -DNOMCS (make MCS=0), it gives a plain lock, for
+// measuring what the queue buys.
+void
+initmcslock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+#ifndef NOMCS
+  lk->mcs = 1;
+#endif
+}
+
+// Join the queue of the MCS lock lk. The caller owns the lock once
+// the wait field of the node returned drops to 0.
+static struct mcsnode*
+mcs_enqueue(struct spinlock *lk)
+{
+  struct mcsnode *n, *prev;
+
+  for(n = mcsnodes[cpuid()]; n < mcsnodes[cpuid()] + NMCS; n++)
+    if(!n->inuse)
+      break;
+  if(n == mcsnodes[cpuid()] + NMCS)
+    panic("acquire: too many mcs locks");
+  n->inuse = 1;
+  n->next = 0;
+  n->wait = 1;
+
+  prev = __atomic_exchange_n(&lk->tail, n, __ATOMIC_ACQ_REL);
+  if(prev == 0)
+    n->wait = 0;
+  else
+    __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+  return n;
+}
+
+// Hand the MCS lock lk over to the next cpu in its queue, if any.
+static void
+mcs_handoff(struct spinlock *lk)
+{
+  struct mcsnode *n = lk->owner, *next, *expected = n;
+
+  lk->owner = 0;
+  if((next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)) == 0){
+    if(__atomic_compare_exchange_n(&lk->tail, &expected, 0, 0,
+                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+      n->inuse = 0;
+      return;
+    }
+    // Someone has joined the queue, but not linked in yet.
+    while((next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)) == 0)
+      ;
+  }
+  __atomic_store_n(&next->wait, 0, __ATOMIC_RELEASE);
+  n->inuse = 0;
+}
+
+#ifdef LOCKSTAT
+// Note when the caller started waiting for a lock.
+static void
+waiting(int *contended, uint64 *start)
+{
+  if(!*contended){
+    *contended = 1;
+    *start = r_time();
+  }
 }
+#endif
 
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
@@ -25,12 +116,33 @@ acquire(struct spinlock *lk)
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+#ifdef LOCKSTAT
+  int contended = 0;
+  uint64 start = 0;
+#endif
+
+  if(lk->mcs){
+    struct mcsnode *n = mcs_enqueue(lk);
+    while(__atomic_load_n(&n->wait, __ATOMIC_ACQUIRE)){
+#ifdef LOCKSTAT
+      waiting(&contended, &start);
+#endif
+    }
+    lk->owner = n;
+    lk->locked = 1;
+  } else {
+    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+    //   a5 = 1
+    //   s1 = &lk->locked
+    //   amoswap.w.aq a5, a5, (s1)
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+#ifdef LOCKSTAT
+      waiting(&contended, &start);
+#endif
+      while(__atomic_load_n(&lk->locked, __ATOMIC_RELAXED))
+        ;
+    }
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +152,11 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+#ifdef LOCKSTAT
+  lockstat_acquire(lk, (uint64)__builtin_return_address(0), contended,
+                   contended ? r_time() - start : 0);
+#endif
 }
 
 // Release the lock.
@@ -49,6 +166,10 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+#ifdef LOCKSTAT
+  lockstat_release(lk);
+#endif
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,6 +180,13 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+  if(lk->mcs){
+    lk->locked = 0;
+    mcs_handoff(lk);
+    pop_off();
+    return;
+  }
+
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -1,13 +1,33 @@
 #ifndef SPINLOCK_H_
 #define SPINLOCK_H_
 
+// Place of a cpu in the queue of an MCS lock (see spinlock.c).
+// Each one has a cache line of its own to spin on.
+struct mcsnode {
+  struct mcsnode *next;  // Next cpu in the queue.
+  int wait;              // Must it keep waiting?
+  int inuse;             // Is it in a queue?
+} __attribute__ ((aligned (64)));
+
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
 
+  // MCS queue locks only (see initmcslock()):
+  int mcs;                // Is it one?
+  struct mcsnode *tail;   // Last cpu in the queue, or null if free.
+  struct mcsnode *owner;  // Node of the holder.
+
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+#ifdef LOCKSTAT
+  // Statistics of the current holder's acquire() site, and mtime
+  // when it got hold of it (see lockstat.c).
+  struct lsentry *stat;
+  uint64 acquired;
+#endif
 };
 
 #endif
@@ -5,14 +5,19 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "syscall.h"
+#include "scstat.h"
 #include "defs.h"
 
+// System call statistics of each hart. Each is only updated
+// by its own hart, with interrupts off.
+static struct scstat cpuscstat[NCPU];
+
 // Fetch the uint64 at addr from the current process.
 int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(copyin(&p->uvm, (char *)ip, addr, sizeof(*ip)) != 0)
+  if(copyin(p->uvm, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
   return 0;
 }
@@ -23,7 +28,7 @@ int
 fetchstr(uint64 addr, char *buf, int max)
 {
   struct proc *p = myproc();
-  int err = copyinstr(&p->uvm, buf, addr, max);
+  int err = copyinstr(p->uvm, buf, addr, max);
   if(err < 0)
     return err;
   return strlen(buf);
@@ -106,8 +111,26 @@ extern uint64 sys_settickets(void);
 extern uint64 sys_getpinfo(void);
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
+extern uint64 sys_schedctl(void);
+extern uint64 sys_getcpuinfo(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_mkcurrency(void);
+extern uint64 sys_setcurrency(void);
+extern uint64 sys_wait2(void);
+extern uint64 sys_sched_setattr(void);
+extern uint64 sys_sched_setaffinity(void);
+extern uint64 sys_uring_setup(void);
+extern uint64 sys_uring_enter(void);
+extern uint64 sys_getscstat(void);
+extern uint64 sys_profctl(void);
+extern uint64 sys_getlockstat(void);
+extern uint64 sys_waitscstat(void);
 
-static uint64 (*syscalls[])(void) = {
+static uint64 (*syscalls[NSYSCALL])(void) = {
 [SYS_fork]          sys_fork,
 [SYS_exit]          sys_exit,
 [SYS_wait]          sys_wait,
@@ -133,8 +156,84 @@ static uint64 (*syscalls[])(void) = {
 [SYS_getpinfo]      sys_getpinfo,
 [SYS_mmap]          sys_mmap,
 [SYS_munmap]        sys_munmap,
+[SYS_schedctl]      sys_schedctl,
+[SYS_getcpuinfo]    sys_getcpuinfo,
+[SYS_clone]         sys_clone,
+[SYS_join]          sys_join,
+[SYS_futex_wait]    sys_futex_wait,
+[SYS_futex_wake]    sys_futex_wake,
+[SYS_nanosleep]     sys_nanosleep,
+[SYS_mkcurrency]    sys_mkcurrency,
+[SYS_setcurrency]   sys_setcurrency,
+[SYS_wait2]         sys_wait2,
+[SYS_sched_setattr] sys_sched_setattr,
+[SYS_sched_setaffinity] sys_sched_setaffinity,
+[SYS_uring_setup]   sys_uring_setup,
+[SYS_uring_enter]   sys_uring_enter,
+[SYS_getscstat]     sys_getscstat,
+[SYS_profctl]       sys_profctl,
+[SYS_getlockstat]   sys_getlockstat,
+[SYS_waitscstat]    sys_waitscstat,
 };
 
+// Count a call to system call num, as it starts,
+// for the calling process and the hart.
+static void
+scstat_call(int num)
+{
+  myproc()->scstat->count[num]++;
+  push_off();
+  cpuscstat[cpuid()].count[num]++;
+  pop_off();
+}
+
+// Add a call to num that took cycles to the statistics,
+// as it returns.
+static void
+scstat_done(int num, uint64 cycles)
+{
+  struct scstat *st = myproc()->scstat;
+  int b = 0;
+
+  while(b < NSCHIST - 1 && (cycles >> (b + 1)) != 0)
+    b++;
+  st->cycles[num] += cycles;
+  st->hist[num][b]++;
+  push_off();
+  st = &cpuscstat[cpuid()];
+  st->cycles[num] += cycles;
+  st->hist[num][b]++;
+  pop_off();
+}
+
+// Copy the system call statistics of hart cpu to st.
+// Returns 0, or -1 if there is no such hart.
+int
+cpu_scstat(int cpu, struct scstat *st)
+{
+  if(cpu < 0 || cpu >= NCPU)
+    return -1;
+  memmove(st, &cpuscstat[cpu], sizeof(*st));
+  return 0;
+}
+
+// Run system call num with the arguments in the trapframe,
+// for syscall() and uring_enter(), and account for it.
+// Returns -1 if there is no such system call.
+uint64
+syscall_run(int num)
+{
+  uint64 start, ret;
+
+  if(num <= 0 || num >= NELEM(syscalls) || syscalls[num] == 0)
+    return -1;
+  scstat_call(num);
+  start = r_time();
+  ret = syscalls[num]();
+  scstat_done(num, r_time() - start);
+  return ret;
+}
+
 void
 syscall(void)
 {
@@ -143,7 +242,7 @@ syscall(void)
 
   num = p->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
-    p->trapframe->a0 = syscalls[num]();
+    p->trapframe->a0 = syscall_run(num);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
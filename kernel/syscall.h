@@ -23,4 +23,22 @@
 #define SYS_settickets  22
 #define SYS_getpinfo    23
 #define SYS_mmap        24
-#define SYS_munmap      25
\ No newline at end of file
+#define SYS_munmap      25
+#define SYS_schedctl    26
+#define SYS_getcpuinfo  27
+#define SYS_clone       28
+#define SYS_join        29
+#define SYS_futex_wait  30
+#define SYS_futex_wake  31
+#define SYS_nanosleep   32
+#define SYS_mkcurrency  33
+#define SYS_setcurrency 34
+#define SYS_wait2       35
+#define SYS_sched_setattr 36
+#define SYS_sched_setaffinity 37
+#define SYS_uring_setup 38
+#define SYS_uring_enter 39
+#define SYS_getscstat   40
+#define SYS_profctl     41
+#define SYS_getlockstat 42
+#define SYS_waitscstat  43
\ No newline at end of file
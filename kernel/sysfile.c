@@ -20,14 +20,25 @@
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// The file table is shared by the threads of a process, and another
+// one may close the descriptor at any time, so the file comes with a
+// reference of its own, which the caller must drop with fileclose().
 static int argfd(int n, int* pfd, struct file** pf) {
   int fd;
   struct file* f;
+  struct fdtable* fdt = myproc()->fdt;
 
   if (argint(n, &fd) < 0) return -1;
-  if (fd < 0 || fd >= NOFILE || (f = myproc()->ofile[fd]) == 0) return -1;
+  if (fd < 0 || fd >= NOFILE) return -1;
+  acquire(&fdt->lock);
+  if ((f = fdt->ofile[fd]) == 0) {
+    release(&fdt->lock);
+    return -1;
+  }
+  filedup(f);
+  release(&fdt->lock);
   if (pfd) *pfd = fd;
-  if (pf) *pf = f;
+  *pf = f;
   return 0;
 }
 
@@ -35,58 +46,95 @@ static int argfd(int n, int* pfd, struct file** pf) {
 // Takes over file reference from caller on success.
 static int fdalloc(struct file* f) {
   int fd;
-  struct proc* p = myproc();
+  struct fdtable* fdt = myproc()->fdt;
 
+  acquire(&fdt->lock);
   for (fd = 0; fd < NOFILE; fd++) {
-    if (p->ofile[fd] == 0) {
-      p->ofile[fd] = f;
+    if (fdt->ofile[fd] == 0) {
+      fdt->ofile[fd] = f;
+      release(&fdt->lock);
       return fd;
     }
   }
+  release(&fdt->lock);
   return -1;
 }
 
+// Release a file descriptor and return its file, or 0 if it was not open.
+// The caller takes over the file reference.
+static struct file* fdfree(int fd) {
+  struct file* f;
+  struct fdtable* fdt = myproc()->fdt;
+
+  acquire(&fdt->lock);
+  f = fdt->ofile[fd];
+  fdt->ofile[fd] = 0;
+  release(&fdt->lock);
+  return f;
+}
+
 uint64 sys_dup(void) {
   struct file* f;
   int fd;
 
   if (argfd(0, 0, &f) < 0) return -1;
-  if ((fd = fdalloc(f)) < 0) return -1;
-  filedup(f);
+  // The new descriptor takes over the reference of argfd().
+  if ((fd = fdalloc(f)) < 0) {
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
 uint64 sys_read(void) {
   struct file* f;
-  int n;
+  int n, r = -1;
   uint64 p;
 
-  if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0) return -1;
-  return fileread(f, p, n);
+  if (argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  // Make sure the user buffer is mapped and writable, so that
+  // copying into it does not fault while holding file locks.
+  struct uvm* uvm = myproc()->uvm;
+  for (uint64 vaddr = PGROUNDDOWN(p); vaddr < p+n; vaddr += PGSIZE) {
+    if (uvm_guaranteecomplete(uvm, vaddr, PTE_W) == 0) goto out;
+  }
+
+  r = fileread(f, p, n);
+out:
+  fileclose(f);
+  return r;
 }
 
 uint64 sys_write(void) {
   struct file* f;
-  int n;
+  int n, r = -1;
   uint64 p;
 
-  if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0) return -1;
+  if (argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
   // Make sure the user data is mapeed to avoid data races.
   // This is a bad solution. (See documentation.)
-  struct uvm* uvm = &myproc()->uvm;
+  struct uvm* uvm = myproc()->uvm;
   for (uint64 vaddr = PGROUNDDOWN(p); vaddr < p+n; vaddr += PGSIZE) {
-    if (uvm_guaranteecomplete(uvm, vaddr, PTE_R) == 0) return -1;
+    if (uvm_guaranteecomplete(uvm, vaddr, PTE_R) == 0) goto out;
   }
 
-  return filewrite(f, p, n);
+  r = filewrite(f, p, n);
+out:
+  fileclose(f);
+  return r;
 }
 
 uint64 sys_close(void) {
   int fd;
   struct file* f;
 
-  if (argfd(0, &fd, &f) < 0) return -1;
-  myproc()->ofile[fd] = 0;
+  if (argint(0, &fd) < 0 || fd < 0 || fd >= NOFILE) return -1;
+  // The descriptor's reference goes with it. Another thread may have
+  // closed it already, or still be using the file through a reference
+  // of its own.
+  if ((f = fdfree(fd)) == 0) return -1;
   fileclose(f);
   return 0;
 }
@@ -95,8 +143,12 @@ uint64 sys_fstat(void) {
   struct file* f;
   uint64 st;  // user pointer to struct stat
 
-  if (argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0) return -1;
-  return filestat(f, st);
+  int r;
+
+  if (argaddr(1, &st) < 0 || argfd(0, 0, &f) < 0) return -1;
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -354,13 +406,14 @@ uint64 sys_chdir(void) {
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilock_shared(ip);
   if (ip->type != T_DIR) {
-    iunlockput(ip);
+    iunlock_shared(ip);
+    iput(ip);
     end_op();
     return -1;
   }
-  iunlock(ip);
+  iunlock_shared(ip);
   iput(p->cwd);
   end_op();
   p->cwd = ip;
@@ -413,15 +466,15 @@ uint64 sys_pipe(void) {
   if (pipealloc(&rf, &wf) < 0) return -1;
   fd0 = -1;
   if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
-    if (fd0 >= 0) p->ofile[fd0] = 0;
+    if (fd0 >= 0) fdfree(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
-  if (copyout(&p->uvm, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
-      copyout(&p->uvm, fdarray + sizeof(fd0), (char*)&fd1, sizeof(fd1)) < 0) {
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+  if (copyout(p->uvm, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
+      copyout(p->uvm, fdarray + sizeof(fd0), (char*)&fd1, sizeof(fd1)) < 0) {
+    fdfree(fd0);
+    fdfree(fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -429,12 +482,27 @@ uint64 sys_pipe(void) {
   return 0;
 }
 
+// Map length bytes of the file f at addr, or wherever there is room.
+static uint64 mmapfile(struct file* f, uint64 addr, size_t length, int perm,
+                       int flags, int offset) {
+  if (f->type != FD_INODE) return -1;
+  struct inode* ip = f->ip;
+  if ((perm & PROT_READ) && !f->readable) return -1;
+  if ((perm & PROT_WRITE) && flags == MAP_SHARED && !f->writable) return -1;
+  struct uvm* uvm = myproc()->uvm;
+  if (!uvm_israngefree(uvm, addr, length) &&
+      (addr = getfreevrange(uvm, length)) == 0) {
+    return -1;
+  }
+  return uvm_map(uvm, addr, length, perm, flags, ip, offset,
+                 ip->size - offset);
+}
+
 uint64 sys_mmap(void) {
   uint64 addr;
   size_t length;
   int perm;
   int flags;
-  int fd;
   int offset;
   struct file* f;
 
@@ -442,19 +510,12 @@ uint64 sys_mmap(void) {
   if (argaddr(1, &length) < 0) return -1;
   if (argint(2, &perm) < 0) return -1;
   if (argint(3, &flags) < 0) return -1;
-  if (argfd(4, &fd, &f) < 0) return -1;
   if (argint(5, &offset) < 0) return -1;
+  if (argfd(4, 0, &f) < 0) return -1;
 
-  if (f->type != FD_INODE) return -1;
-  struct inode* ip = f->ip;
-  if ((perm & PROT_READ) && !f->readable) return -1;
-  if ((perm & PROT_WRITE) && flags == MAP_SHARED && !f->writable) return -1;
-  struct uvm* uvm = &myproc()->uvm;
-  if (!uvm_israngefree(uvm, addr, length) &&
-      (addr = getfreevrange(uvm, length)) == 0) {
-    return -1;
-  }
-  addr = uvm_map(uvm, addr, length, perm, flags, ip, offset, ip->size - offset);
+  // The vma holds on to the inode, not to f.
+  addr = mmapfile(f, addr, length, perm, flags, offset);
+  fileclose(f);
   return addr;
 }
 
@@ -463,11 +524,5 @@ uint64 sys_munmap(void) {
   size_t length;
   if (argaddr(0, &addr) < 0) return -1;
   if (argaddr(1, &length) < 0) return -1;
-  struct uvm* uvm = &myproc()->uvm;
-  struct vma* vma = uvm_va2vma(uvm, addr);
-  if (uvm == 0) return -1;
-  if (addr != vma->start && addr + length != vma->start + vma->length)
-    return -1;
-  uvm_unmap(uvm, addr, length);
-  return 0;
+  return uvm_unmap(myproc()->uvm, addr, length);
 }
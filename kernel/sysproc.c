@@ -1,10 +1,14 @@
+#include "cpustat.h"
 #include "date.h"
 #include "defs.h"
+#include "kalloc.h"
 #include "memlayout.h"
 #include "param.h"
 #include "proc.h"
 #include "pstat.h"
 #include "riscv.h"
+#include "scstat.h"
+#include "sched.h"
 #include "spinlock.h"
 #include "types.h"
 
@@ -22,35 +26,81 @@ uint64 sys_fork(void) { return fork(); }
 uint64 sys_wait(void) {
   uint64 p;
   if (argaddr(0, &p) < 0) return -1;
-  return wait(p);
+  return wait(p, 0, 0);
+}
+
+uint64 sys_wait2(void) {
+  uint64 p, ru;
+  if (argaddr(0, &p) < 0 || argaddr(1, &ru) < 0) return -1;
+  return wait(p, ru, 0);
+}
+
+uint64 sys_waitscstat(void) {
+  uint64 p, st;
+  if (argaddr(0, &p) < 0 || argaddr(1, &st) < 0) return -1;
+  return wait(p, 0, st);
+}
+
+uint64 sys_clone(void) {
+  uint64 fn, arg, stack;
+  if (argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64 sys_join(void) {
+  int tid;
+  if (argint(0, &tid) < 0) return -1;
+  return join(tid);
+}
+
+uint64 sys_futex_wait(void) {
+  uint64 addr;
+  int val, timeout;
+  if (argaddr(0, &addr) < 0 || argint(1, &val) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  return futex_wait(addr, val, timeout);
+}
+
+uint64 sys_futex_wake(void) {
+  uint64 addr;
+  int n;
+  if (argaddr(0, &addr) < 0 || argint(1, &n) < 0) return -1;
+  return futex_wake(addr, n);
 }
 
 uint64 sys_sbrk(void) {
   int n;
   if (argint(0, &n) < 0) return -1;
-  struct uvm* uvm = &myproc()->uvm;
+  struct uvm* uvm = myproc()->uvm;
   if (uvm == 0 || uvm->heap == 0) panic("sys_sbrk\n");
-  uint64 addr = uvm->heap->start + uvm->heap->length;
-  if (uvm_growheap(uvm, n) < 0) return -1;
-  return addr;
+  return uvm_growheap(uvm, n);
+}
+
+// Sleep until mtime reaches deadline.
+// Returns 0, or -1 if killed first.
+static int sleeptill(uint64 deadline) {
+  while (r_time() < deadline) {
+    if (myproc()->killed) return -1;
+    sleep_until(0, 0, deadline);
+  }
+  return 0;
 }
 
 uint64 sys_sleep(void) {
   int n;
-  uint ticks0;
 
-  if (argint(0, &n) < 0) return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while (ticks - ticks0 < n) {
-    if (myproc()->killed) {
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if (argint(0, &n) < 0 || n < 0) return -1;
+  return sleeptill(r_time() + (uint64)n * TICK_CYCLES);
+}
+
+// sleep for the given number of nanoseconds,
+// to the resolution of the mtime counter.
+uint64 sys_nanosleep(void) {
+  uint64 ns;
+
+  if (argaddr(0, &ns) < 0) return -1;
+  return sleeptill(r_time() + ns / (1000000000 / MTIME_FREQ));
 }
 
 uint64 sys_kill(void) {
@@ -60,15 +110,10 @@ uint64 sys_kill(void) {
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
+// return how many clock tick periods have elapsed
 // since start.
 uint64 sys_uptime(void) {
-  uint xticks;
-
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  return r_time() / TICK_CYCLES;
 }
 
 // set the number of lottery assignment ticket
@@ -77,27 +122,147 @@ uint64 sys_settickets(void) {
   int n;
 
   if (argint(0, &n) < 0) return -1;
-  if (n < 1) return -1;
-  // There is no need to protect this access with a lock,
-  // because this is the only way of modifying this value.
-  myproc()->tickets = n;
-  return 0;
+  return settickets(n);
+}
+
+// create a ticket currency funded with the given
+// number of the caller's tickets, and move into it.
+uint64 sys_mkcurrency(void) {
+  int funding;
+
+  if (argint(0, &funding) < 0) return -1;
+  return mkcurrency(funding);
+}
+
+// move into a ticket currency (0 for the base one).
+uint64 sys_setcurrency(void) {
+  int id;
+
+  if (argint(0, &id) < 0) return -1;
+  return setcurrency(id);
+}
+
+// change a setting of the scheduler (see sched.h).
+uint64 sys_schedctl(void) {
+  int op, val;
+
+  if (argint(0, &op) < 0 || argint(1, &val) < 0) return -1;
+  return schedctl(op, val);
+}
+
+// set the scheduling class of a process (see sched.h).
+uint64 sys_sched_setattr(void) {
+  struct sched_attr attr;
+  uint64 addr;
+  int pid;
+
+  if (argint(0, &pid) < 0 || argaddr(1, &addr) < 0) return -1;
+  if (copyin(myproc()->uvm, (char*)&attr, addr, sizeof(attr)) < 0) return -1;
+  return sched_setattr(pid, attr.policy, attr.priority);
+}
+
+// restrict a process to some harts, a bit of the mask each.
+uint64 sys_sched_setaffinity(void) {
+  uint64 mask;
+  int pid;
+
+  if (argint(0, &pid) < 0 || argaddr(1, &mask) < 0) return -1;
+  return sched_setaffinity(pid, mask);
+}
+
+// map the system call rings of the address space (see uring.c).
+uint64 sys_uring_setup(void) { return uring_setup(); }
+
+// run the system calls queued in the submission ring.
+uint64 sys_uring_enter(void) {
+  int n;
+
+  if (argint(0, &n) < 0) return -1;
+  return uring_enter(n);
+}
+
+// copy out the system call statistics of a process or a hart
+// (see scstat.h).
+uint64 sys_getscstat(void) {
+  struct scstat *st;
+  uint64 addr;
+  int kind, id, r = -1;
+
+  if (argint(0, &kind) < 0 || argint(1, &id) < 0 || argaddr(2, &addr) < 0)
+    return -1;
+  // Too big for the stack.
+  if ((st = (struct scstat*)kalloc()) == 0) return -1;
+  if (kind == SCSTAT_PROC)
+    r = proc_scstat(id, st);
+  else if (kind == SCSTAT_CPU)
+    r = cpu_scstat(id, st);
+  if (r == 0) r = copyout(myproc()->uvm, addr, (char*)st, sizeof(*st));
+  kfree((uint64)st);
+  return r;
 }
 
 uint64 sys_getpinfo(void) {
-  extern struct proc proc[NPROC];
+  extern struct proc *allproc;
   struct pstat procstat;
+  struct proc *p;
   uint64 useraddr;
   int i;
 
   if (argaddr(0, &useraddr) < 0) return -1;
   if (!useraddr) return -1;
 
-  for (i = 0; i < NPROC; i++) {
-    procstat.inuse[i] = proc[i].state != UNUSED;
-    procstat.tickets[i] = proc[i].tickets;
-    procstat.pid[i] = proc[i].pid;
-    procstat.ticks[i] = proc[i].ticks;
+  // Report the first NPROC processes in use.
+  memset(&procstat, 0, sizeof(procstat));
+  for (i = 0, p = allproc; i < NPROC && p; p = p->allnext) {
+    if (p->state == UNUSED) continue;
+    procstat.inuse[i] = 1;
+    procstat.tickets[i] = p->tickets;
+    procstat.efftickets[i] = p->efftickets;
+    procstat.currency[i] = currencyof(p);
+    procstat.rtprio[i] = p->rtprio;
+    procstat.affinity[i] = p->affinity;
+    procstat.pid[i] = p->pid;
+    procstat.ticks[i] = p->ticks;
+    procstat.utime[i] = p->utime;
+    procstat.stime[i] = p->stime;
+    i++;
   }
-  return copyout(&myproc()->uvm, useraddr, (char*)&procstat, sizeof(procstat));
+  return copyout(myproc()->uvm, useraddr, (char*)&procstat, sizeof(procstat));
+}
+
+uint64 sys_getcpuinfo(void) {
+  struct cpustat cpustat;
+  uint64 useraddr;
+  int i;
+
+  if (argaddr(0, &useraddr) < 0) return -1;
+  if (!useraddr) return -1;
+
+  for (i = 0; i < NCPU; i++) {
+    cpustat.online[i] = cpus[i].online;
+    cpustat.idle[i] = cpus[i].idletime;
+    cpustat.ticks[i] = cpus[i].ticks;
+    cpustat.slspin[i] = cpus[i].slspins;
+    cpustat.slsleep[i] = cpus[i].slsleeps;
+  }
+  cpustat.time = r_time();
+  return copyout(myproc()->uvm, useraddr, (char*)&cpustat, sizeof(cpustat));
+}
+
+// start or stop the sampling profiler (see prof.c).
+uint64 sys_profctl(void) {
+  int hz;
+
+  if (argint(0, &hz) < 0) return -1;
+  return profctl(hz);
+}
+
+// copy out the spinlock statistics of up to n locks,
+// or clear them if the buffer is null (see lockstat.c).
+uint64 sys_getlockstat(void) {
+  uint64 addr;
+  int n;
+
+  if (argaddr(0, &addr) < 0 || argint(1, &n) < 0) return -1;
+  return lockstat_read(addr, n);
 }
@@ -0,0 +1,293 @@
+// Timers.
+//
+// Every hart keeps the timers armed on it in a hierarchical timing
+// wheel. Level 0 has WHEEL_SIZE slots of one granule (1 << TIMER_SHIFT
+// cycles of mtime) each, holding the timers due within WHEEL_SIZE
+// granules; a slot of level l is WHEEL_SIZE times wider than one of
+// level l-1, and holds timers due correspondingly later. Whenever the
+// clock of a level wraps around, the next slot of the level above is
+// cascaded: its timers are placed again, into the lower levels. Adding
+// or deleting a timer is O(1), and a timer is moved at most
+// WHEEL_LEVELS-1 times before it expires.
+//
+// Instead of interrupting at a fixed rate, each hart programs its
+// CLINT mtimecmp for the earlier of its next clock tick and the next
+// event of its wheel: the expiry of the first timer of level 0, or the
+// next cascade of an upper level. So a timer goes off as soon as it is
+// due, not at the next tick, and only the processes whose timer expired
+// are woken up. timervec in kernelvec.S disarms mtimecmp when it fires
+// and timer_intr() arms it again.
+//
+// The clock tick itself only serves to preempt the running process in
+// favour of the others queued on the hart, so a hart whose run queue
+// is empty at a tick stops ticking (goes tickless): a lone compute-bound
+// process then runs undisturbed, and an idle hart sleeps in wfi until
+// its next timer. Whoever queues a process on a tickless hart kicks it
+// with an IPI, and the hart starts ticking again (see runq_add()).
+//
+// A timer stays on the wheel of the hart that added it. Its function
+// is called from that hart's timer interrupt with the wheel lock held,
+// so it must not add or delete timers itself. The lock of a wheel is
+// acquired before any p->lock.
+
+#include "defs.h"
+#include "memlayout.h"
+#include "param.h"
+#include "proc.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "types.h"
+
+// Index of the first busy slot in circular order from i, or -1.
+static int nextslot(uint64 busy, int i) {
+  if (busy == 0) return -1;
+  while ((busy & (1ull << i)) == 0) i = (i + 1) & WHEEL_MASK;
+  return i;
+}
+
+// Put t in the slot of w matching its expiry.
+// Caller must hold w->lock.
+static void wheel_place(struct wheel *w, struct timer *t) {
+  uint64 g = t->expires >> TIMER_SHIFT;
+  uint64 delta;
+  int level;
+
+  // A timer already due goes to the slot being run.
+  if (g < w->clk) g = w->clk;
+  delta = g - w->clk;
+  for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+    if (delta < 1ull << (WHEEL_BITS * (level + 1))) break;
+  }
+  // Beyond the reach of the wheel: park it in the last slot,
+  // it is placed again when that is cascaded.
+  if (delta >= 1ull << (WHEEL_BITS * WHEEL_LEVELS))
+    g = w->clk + (1ull << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+  t->level = level;
+  t->idx = (g >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  t->pprev = &w->slot[level][t->idx];
+  t->next = *t->pprev;
+  if (t->next) t->next->pprev = &t->next;
+  *t->pprev = t;
+  w->busy[level] |= 1ull << t->idx;
+}
+
+// Take t off its slot.
+// Caller must hold w->lock.
+static void wheel_unlink(struct wheel *w, struct timer *t) {
+  *t->pprev = t->next;
+  if (t->next) t->next->pprev = t->pprev;
+  if (w->slot[t->level][t->idx] == 0) w->busy[t->level] &= ~(1ull << t->idx);
+  t->next = 0;
+  t->pprev = 0;
+}
+
+// Place the timers of a slot of an upper level again.
+// Caller must hold w->lock.
+static void wheel_cascade(struct wheel *w, int level, int idx) {
+  struct timer *t = w->slot[level][idx], *next;
+
+  w->slot[level][idx] = 0;
+  w->busy[level] &= ~(1ull << idx);
+  for (; t; t = next) {
+    next = t->next;
+    wheel_place(w, t);
+  }
+}
+
+static int wheel_empty(struct wheel *w) {
+  for (int l = 0; l < WHEEL_LEVELS; l++) {
+    if (w->busy[l]) return 0;
+  }
+  return 1;
+}
+
+// Run the timers of w due by now, advancing its clock.
+// Caller must hold w->lock.
+static void wheel_run(struct wheel *w, uint64 now) {
+  uint64 nowg = now >> TIMER_SHIFT, next;
+  struct timer *t, *tnext;
+  int i, l, s;
+
+  for (;;) {
+    i = w->clk & WHEEL_MASK;
+    for (t = w->slot[0][i]; t; t = tnext) {
+      tnext = t->next;
+      if (t->expires > now) continue;
+      wheel_unlink(w, t);
+      t->fn(t->arg);
+      // Let timer_del() know the function has returned.
+      __atomic_store_n(&t->wheel, 0, __ATOMIC_RELEASE);
+    }
+    if (w->clk >= nowg) break;
+
+    // The slot is empty now. Skip to the next granule with work:
+    // the next busy slot of level 0 or the next cascade, if not later
+    // than now.
+    if (wheel_empty(w)) {
+      w->clk = nowg;
+      break;
+    }
+    next = (w->clk | WHEEL_MASK) + 1;
+    if ((s = nextslot(w->busy[0], i)) > i) next = w->clk - i + s;
+    if (next > nowg) next = nowg;
+    w->clk = next;
+    if ((w->clk & WHEEL_MASK) == 0) {
+      for (l = 1; l < WHEEL_LEVELS; l++) {
+        s = (w->clk >> (WHEEL_BITS * l)) & WHEEL_MASK;
+        wheel_cascade(w, l, s);
+        if (s != 0) break;
+      }
+    }
+  }
+}
+
+// mtime at which w has to run next: the expiry of its first timer
+// of level 0 or the next cascade of a busy upper slot, whichever is
+// first; or -1 if it has no timers.
+// Caller must hold w->lock.
+static uint64 wheel_next(struct wheel *w) {
+  uint64 next = -1, clk, when;
+  struct timer *t;
+  int i, l, s;
+
+  // Level 0 is in expiry order starting at the slot being run.
+  if ((s = nextslot(w->busy[0], w->clk & WHEEL_MASK)) >= 0) {
+    for (t = w->slot[0][s]; t; t = t->next) {
+      if (t->expires < next) next = t->expires;
+    }
+  }
+  // The slot of an upper level at the current index is a whole
+  // revolution away, its timers were placed after it was cascaded.
+  for (l = 1; l < WHEEL_LEVELS; l++) {
+    clk = w->clk >> (WHEEL_BITS * l);
+    i = clk & WHEEL_MASK;
+    if ((s = nextslot(w->busy[l], (i + 1) & WHEEL_MASK)) < 0) continue;
+    clk += s > i ? s - i : s - i + WHEEL_SIZE;
+    when = clk << (WHEEL_BITS * l + TIMER_SHIFT);
+    if (when < next) next = when;
+  }
+  return next;
+}
+
+// Arm mtimecmp for the next clock tick or wheel event of c.
+// Caller must hold c->wheel.lock.
+static void timer_program(struct cpu *c) {
+  uint64 next = wheel_next(&c->wheel);
+
+  if (c->nexttick < next) next = c->nexttick;
+  *(uint64 *)CLINT_MTIMECMP(c - cpus) = next;
+}
+
+// Decide whether c has to tick: only if processes wait in its run queue.
+// Returns 1 if a clock tick is due now.
+// Caller must hold c->wheel.lock.
+static int tick_update(struct cpu *c, uint64 now) {
+  if (c->tickless) {
+    if (c->rq.nproc > 0) {
+      c->tickless = 0;
+      c->nexttick = now + TICK_CYCLES;
+    }
+    return 0;
+  }
+  if (now < c->nexttick) return 0;
+
+  // Pairs with the fence in runq_add(): either it sees this hart
+  // tickless and kicks it, or we see the process it queued.
+  c->tickless = 1;
+  __sync_synchronize();
+  if (c->rq.nproc == 0) {
+    c->nexttick = -1;
+    return 0;
+  }
+  c->tickless = 0;
+  // Like the CLINT, keep a regular pace: a late tick makes the
+  // next one come sooner.
+  c->nexttick += TICK_CYCLES;
+  c->ticks++;
+  return 1;
+}
+
+// Start the clock ticks and timers of this hart.
+void timerinithart(void) {
+  struct cpu *c = mycpu();
+
+  // Let user mode read the time CSR, for clock_gettime().
+  w_scounteren(r_scounteren() | 2);
+
+  initlock(&c->wheel.lock, "wheel");
+  acquire(&c->wheel.lock);
+  c->wheel.clk = r_time() >> TIMER_SHIFT;
+  c->nexttick = r_time() + TICK_CYCLES;
+  timer_program(c);
+  release(&c->wheel.lock);
+}
+
+// Arrange for fn(arg) to be called once mtime reaches expires,
+// on this hart. t must not be pending already.
+void timer_add(struct timer *t, uint64 expires, void (*fn)(void *),
+               void *arg) {
+  struct cpu *c;
+
+  if (t->wheel) panic("timer_add");
+  push_off();
+  c = mycpu();
+  acquire(&c->wheel.lock);
+  t->expires = expires;
+  t->fn = fn;
+  t->arg = arg;
+  t->wheel = &c->wheel;
+  wheel_place(&c->wheel, t);
+  timer_program(c);
+  release(&c->wheel.lock);
+  pop_off();
+}
+
+// Cancel t if it is pending. On return its function is not running,
+// and won't be called.
+void timer_del(struct timer *t) {
+  struct wheel *w;
+
+  while ((w = __atomic_load_n(&t->wheel, __ATOMIC_ACQUIRE)) != 0) {
+    acquire(&w->lock);
+    if (t->wheel == w) {
+      wheel_unlink(w, t);
+      t->wheel = 0;
+    }
+    release(&w->lock);
+  }
+}
+
+// Handle a timer interrupt: run the timers of this hart that are
+// due and arm mtimecmp again.
+// Returns 1 if it is time for a clock tick, 0 otherwise.
+int timer_intr(void) {
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+  int tick;
+
+  acquire(&c->wheel.lock);
+  wheel_run(&c->wheel, now);
+  tick = tick_update(c, now);
+  timer_program(c);
+  release(&c->wheel.lock);
+  if (tick) vdso_tick(now);
+  return tick;
+}
+
+// Start ticking again if this hart is tickless
+// and processes have been queued on it.
+void timer_tickcheck(void) {
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  if (c->tickless && c->rq.nproc > 0) {
+    acquire(&c->wheel.lock);
+    tick_update(c, r_time());
+    timer_program(c);
+    release(&c->wheel.lock);
+  }
+  pop_off();
+}
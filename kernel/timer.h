@@ -0,0 +1,36 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include "spinlock.h"
+#include "types.h"
+
+// Hierarchical timer wheel (see timer.c).
+// Level 0 has a slot per granule of 1 << TIMER_SHIFT mtime cycles,
+// and each further level slots are WHEEL_SIZE times wider.
+#define TIMER_SHIFT  10
+#define WHEEL_BITS   6
+#define WHEEL_SIZE   (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+// A function to be called once mtime reaches expires.
+struct timer {
+  uint64 expires;
+  void (*fn)(void *);
+  void *arg;
+  struct wheel *wheel;        // Wheel holding the timer, or 0.
+  struct timer *next;         // Slot list links.
+  struct timer **pprev;
+  int level;                  // Slot holding the timer.
+  int idx;
+};
+
+// Pending timers of a cpu.
+struct wheel {
+  struct spinlock lock;
+  uint64 clk;                         // Granule of the level-0 slot to run.
+  uint64 busy[WHEEL_LEVELS];          // Bitmaps of the non-empty slots.
+  struct timer *slot[WHEEL_LEVELS][WHEEL_SIZE];
+};
+
+#endif
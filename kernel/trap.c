@@ -2,13 +2,11 @@
 #include "memlayout.h"
 #include "param.h"
 #include "proc.h"
+#include "prof.h"
 #include "riscv.h"
 #include "spinlock.h"
 #include "types.h"
 
-struct spinlock tickslock;
-uint ticks;
-
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -16,8 +14,6 @@ void kernelvec();
 
 extern int devintr();
 
-void trapinit(void) { initlock(&tickslock, "time"); }
-
 // set up to take exceptions and traps while in the kernel.
 void trapinithart(void) { w_stvec((uint64)kernelvec); }
 
@@ -35,6 +31,7 @@ void usertrap(void) {
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+  acct(p, 1);
 
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -63,7 +60,9 @@ void usertrap(void) {
       if (cause == 13) missing_perm = PTE_R;
       if (cause == 15) missing_perm = PTE_W;
       if (cause == 12) missing_perm = PTE_X;
-      if (uvm_completemap(&p->uvm, PGROUNDDOWN(fault_addr), missing_perm) ==
+      // Resolving the fault may wait for sibling threads.
+      intr_on();
+      if (uvm_completemap(p->uvm, PGROUNDDOWN(fault_addr), missing_perm) ==
           0) {
         p->killed = 1;
         printf("\nsegmentation fault pid=%d addr=%p missing_perm=%d\n",
@@ -81,6 +80,8 @@ void usertrap(void) {
       break;
   }
 
+  if (which_dev) prof_intr(PROF_USER, p->trapframe->epc, p->trapframe->s0);
+
   if (p->killed) exit(-1);
 
   // give up the CPU if this is a timer interrupt.
@@ -99,6 +100,7 @@ void usertrapret(void) {
   // kerneltrap() to usertrap(), so turn off interrupts until
   // we're back in user space, where usertrap() is correct.
   intr_off();
+  acct(p, 0);
 
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
@@ -123,18 +125,19 @@ void usertrapret(void) {
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->uvm.pagetable);
+  uint64 satp = MAKE_SATP(p->uvm->pagetable);
 
   // jump to trampoline.S at the top of memory, which
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64, uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64, uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
-// on whatever the current kernel stack is.
-void kerneltrap() {
+// on whatever the current kernel stack is. regs points to the
+// registers kernelvec saved there, in its order (s0 is regs[7]).
+void kerneltrap(uint64 *regs) {
   int which_dev = 0;
   uint64 sepc = r_sepc();
   uint64 sstatus = r_sstatus();
@@ -159,7 +162,7 @@ void kerneltrap() {
     //   }
     //   printf("kernel segmentation fault pid=%d addr=%p missing_perm=%d\n",
     //          p->pid, fault_addr, missing_perm);
-    //   if (uvm_completemap(&p->uvm, PGROUNDDOWN(fault_addr), missing_perm) ==
+    //   if (uvm_completemap(p->uvm, PGROUNDDOWN(fault_addr), missing_perm) ==
     //       0) {
     //     p->killed = 1;
     //     printf("kernel segmentation fault pid=%d addr=%p missing_perm=%d\n",
@@ -174,6 +177,8 @@ void kerneltrap() {
       }
   }
 
+  prof_intr(PROF_KERNEL, sepc, regs[7]);
+
   if (p != 0 && p->killed) exit(-1);
 
   // give up the CPU if this is a timer interrupt.
@@ -185,20 +190,23 @@ void kerneltrap() {
   w_sstatus(sstatus);
 }
 
-void clockintr() {
-  acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
+// Did timervec see a timer interrupt since the last call?
+// The flag is swapped out atomically, since timervec may set it again
+// at any time.
+static int timerpending(void) {
+  extern uint64 timer_scratch[NCPU][6];
+  return __sync_lock_test_and_set(&timer_scratch[cpuid()][5], 0);
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if clock tick or asked to reschedule,
 // 1 if other device,
 // 0 if not recognized.
 int devintr() {
   uint64 scause = r_scause();
+  int resched;
+  uint64 gen;
 
   if ((scause & 0x8000000000000000L) && (scause & 0xff) == 9) {
     // this is a supervisor external interrupt, via PLIC.
@@ -221,17 +229,37 @@ int devintr() {
 
     return 1;
   } else if (scause == 0x8000000000000001L) {
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
-
-    if (cpuid() == 0) {
-      clockintr();
-    }
+    // software interrupt from a machine-mode timer interrupt
+    // or from a reschedule IPI, forwarded by timervec in kernelvec.S.
 
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    // a thread on another hart may have changed the page table
+    // of the process running here (see uvm_shootdown()). the
+    // flush covers the requests posted up to gen; a later one
+    // comes with an IPI of its own.
+    gen = __atomic_load_n(&mycpu()->tlbreq, __ATOMIC_ACQUIRE);
+    if (gen != mycpu()->tlbdone) {
+      sfence_vma();
+      __atomic_store_n(&mycpu()->tlbdone, gen, __ATOMIC_RELEASE);
+    }
+
+    // a real-time process may have been queued to preempt
+    // the one running here (see runq_add()).
+    resched = __atomic_exchange_n(&mycpu()->resched, 0, __ATOMIC_ACQ_REL);
+
+    // other IPIs have already done their job by waking this hart up,
+    // unless it has to start ticking again.
+    if (!timerpending()) {
+      timer_tickcheck();
+      return resched ? 2 : 1;
+    }
+    // a timer interrupt may only have had timers to run.
+    if (!timer_intr()) return resched ? 2 : 1;
+
+    runq_tick();
     return 2;
   } else {
     return 0;
@@ -0,0 +1,163 @@
+// System call rings (io_uring-style batching).
+//
+// Every system call pays for a trip through the trampoline, usertrap()
+// and usertrapret(), which dominates programs issuing many small ones.
+// Instead, a process can queue them in the submission ring of a page
+// it shares with the kernel (see uring.h), and have a single
+// uring_enter() run them all through the syscalls[] table, leaving
+// their results in the completion ring.
+//
+// An entry runs as if the calling thread made the system call itself:
+// its arguments are loaded into the thread's trapframe, which is put
+// back afterwards. System calls that replace or end the caller (fork,
+// clone, exec, exit) and those of the rings themselves (uring_setup(),
+// uring_enter()) may not be queued.
+//
+// The process can scribble on the rings at any time, so the kernel
+// copies each SQE before looking at it, takes every index modulo the
+// ring size, and gives up on a submission ring whose tail is out of
+// range. Threads sharing the rings take turns under uvm->ringlock to
+// take SQEs and post CQEs (see uring_enter()); it is acquired before
+// uvm->lock.
+
+#include "defs.h"
+#include "kalloc.h"
+#include "memlayout.h"
+#include "param.h"
+#include "proc.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "syscall.h"
+#include "types.h"
+#include "uring.h"
+#include "uvm.h"
+
+// Map the rings of the caller's address space, creating them the
+// first time, and return their user address, or -1 if out of memory.
+// No vma reaches URING (see uvm_israngefree()), but the page is
+// checked anyway, so that a stray mapping fails the call rather than
+// panic pgt_map().
+uint64 uring_setup(void) {
+  struct uvm *uvm = myproc()->uvm;
+  uint64 pa;
+
+  acquiresleep(&uvm->ringlock);
+  if (uvm->uring == 0) {
+    if ((pa = kalloc()) == 0) goto err;
+    memset((void *)pa, 0, PGSIZE);
+    acquiresleep(&uvm->lock);
+    if (pgt_getpa(uvm->pagetable, URING) != 0 ||
+        pgt_map(uvm->pagetable, URING, pa, PTE_R | PTE_W)) {
+      releasesleep(&uvm->lock);
+      kfree(pa);
+      goto err;
+    }
+    releasesleep(&uvm->lock);
+    sfence_vma();
+    uvm->uring = pa;
+  }
+  releasesleep(&uvm->ringlock);
+  return URING;
+
+err:
+  releasesleep(&uvm->ringlock);
+  return -1;
+}
+
+// Run the system call of sqe on behalf of p, the current process.
+static int uring_run(struct proc *p, struct uring_sqe *sqe) {
+  struct trapframe tf;
+  int res;
+
+  switch (sqe->num) {
+    case SYS_fork:
+    case SYS_clone:
+    case SYS_exec:
+    case SYS_exit:
+    case SYS_uring_setup:
+    case SYS_uring_enter:
+      return -1;
+  }
+  tf = *p->trapframe;
+  p->trapframe->a0 = sqe->args[0];
+  p->trapframe->a1 = sqe->args[1];
+  p->trapframe->a2 = sqe->args[2];
+  p->trapframe->a3 = sqe->args[3];
+  p->trapframe->a4 = sqe->args[4];
+  p->trapframe->a5 = sqe->args[5];
+  p->trapframe->a7 = sqe->num;
+  res = syscall_run(sqe->num);
+  *p->trapframe = tf;
+  return res;
+}
+
+// Run up to to_submit queued SQEs, in order, posting a CQE for each.
+// Stops early if the submission ring empties, the completion ring
+// fills up or the process is killed. A chain of linked entries must
+// be submitted whole: the cancelation does not carry over to the
+// next call.
+// Returns the number of SQEs consumed, or -1 if there are no rings or
+// the submission ring is corrupt.
+//
+// ringlock is only held to take an SQE and to post its CQE, not while
+// the system call runs, which may block for good (a pipe read, a
+// futex wait...) while other threads go on using the rings. Taking an
+// SQE reserves room for its CQE in uvm->ringbusy, so that the
+// completion ring cannot overflow meanwhile. Entries run by different
+// threads may thus complete, and post their CQEs, out of order.
+int uring_enter(int to_submit) {
+  struct proc *p = myproc();
+  struct uvm *uvm = p->uvm;
+  struct uring *r;
+  struct uring_sqe sqe;
+  struct uring_cqe *cqe;
+  uint head, tail, ctail;
+  int n, res, flags, canceled = 0;
+
+  if (to_submit < 0) return -1;
+  acquiresleep(&uvm->ringlock);
+  r = (struct uring *)uvm->uring;
+  releasesleep(&uvm->ringlock);
+  if (r == 0) return -1;
+  for (n = 0; n < to_submit && !p->killed; n++) {
+    acquiresleep(&uvm->ringlock);
+    head = __atomic_load_n(&r->sq_head, __ATOMIC_RELAXED);
+    tail = __atomic_load_n(&r->sq_tail, __ATOMIC_ACQUIRE);
+    if (tail - head > URING_ENTRIES) {
+      releasesleep(&uvm->ringlock);
+      return -1;
+    }
+    // Room for the CQEs of this SQE and of those still running.
+    ctail = __atomic_load_n(&r->cq_tail, __ATOMIC_RELAXED) + uvm->ringbusy;
+    if (head == tail ||
+        ctail - __atomic_load_n(&r->cq_head, __ATOMIC_ACQUIRE) >=
+            URING_ENTRIES) {
+      releasesleep(&uvm->ringlock);
+      break;
+    }
+    sqe = r->sq[head % URING_ENTRIES];
+    __atomic_store_n(&r->sq_head, head + 1, __ATOMIC_RELEASE);
+    uvm->ringbusy++;
+    releasesleep(&uvm->ringlock);
+
+    if (canceled) {
+      res = -1;
+      flags = URING_CANCELED;
+    } else {
+      res = uring_run(p, &sqe);
+      flags = 0;
+    }
+    canceled = (sqe.flags & URING_LINK) && (canceled || res < 0);
+
+    acquiresleep(&uvm->ringlock);
+    ctail = __atomic_load_n(&r->cq_tail, __ATOMIC_RELAXED);
+    cqe = &r->cq[ctail % URING_ENTRIES];
+    cqe->user_data = sqe.user_data;
+    cqe->res = res;
+    cqe->flags = flags;
+    __atomic_store_n(&r->cq_tail, ctail + 1, __ATOMIC_RELEASE);
+    uvm->ringbusy--;
+    releasesleep(&uvm->ringlock);
+  }
+  return n;
+}
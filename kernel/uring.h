@@ -0,0 +1,50 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include "types.h"
+
+// Submission and completion rings, in a page shared by the threads of
+// a process and the kernel, mapped at the address uring_setup()
+// returns. The process fills submission entries (SQEs) in and
+// advances sq_tail; uring_enter() runs them in order and posts a
+// completion entry (CQE) for each, advancing cq_tail; the process
+// reads them and advances cq_head. Indices only ever grow, and wrap
+// around the rings modulo URING_ENTRIES. The CQEs of one uring_enter()
+// call come in the order of its SQEs, but those of threads entering
+// at the same time may interleave.
+
+#define URING_ENTRIES 32  // Entries of each ring, a power of two.
+
+// Flags of an SQE.
+// The next entry is linked to this one: it is canceled if this one
+// fails (returns a negative value), and so on down the chain.
+#define URING_LINK 0x1
+
+// Flags of a CQE.
+#define URING_CANCELED 0x1  // Not run, as an entry it was linked to failed.
+
+// A system call to run: num is its number (see syscall.h).
+struct uring_sqe {
+  int num;
+  int flags;
+  uint64 args[6];
+  uint64 user_data;  // Handed back in the CQE, untouched.
+};
+
+// The result of an SQE.
+struct uring_cqe {
+  uint64 user_data;
+  int res;     // What the system call returned, -1 if canceled.
+  int flags;
+};
+
+struct uring {
+  uint sq_head;  // Next SQE to run, advanced by the kernel.
+  uint sq_tail;  // Next SQE to fill in, advanced by the process.
+  uint cq_head;  // Next CQE to read, advanced by the process.
+  uint cq_tail;  // Next CQE to post, advanced by the kernel.
+  struct uring_sqe sq[URING_ENTRIES];
+  struct uring_cqe cq[URING_ENTRIES];
+};
+
+#endif
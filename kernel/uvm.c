@@ -3,6 +3,7 @@
 #include "kalloc.h"
 #include "memlayout.h"
 #include "pagetable.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "uvm.h"
 
@@ -98,48 +99,179 @@ int vma_intersect(struct vma* v, struct vma* w) {
   return l < r;
 }
 
+// ─────────────────────────────────────────────────────────────────────────────
+// Threads
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Make sure that no other hart running a thread of uvm keeps stale
+// translations of a mapping that has been removed or downgraded:
+// ask each one to flush its TLB, and wait until all have done it.
+// Harts that are not running uvm flush on their way back to user space.
+// Caller must hold uvm->lock, and interrupts should be enabled,
+// since another hart may be shooting at this one.
+static void uvm_shootdown(struct uvm* uvm) {
+  struct proc* me = myproc();
+  struct cpu* c;
+  struct proc* p;
+  uint64 pending = 0, gen[NCPU];
+
+  if (uvm->ref <= 1) return;
+  // Publish the page table changes before looking at who runs uvm.
+  __sync_synchronize();
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    p = c->proc;
+    if (p == 0 || p == me || p->uvm != uvm) continue;
+    gen[c - cpus] = __atomic_add_fetch(&c->tlbreq, 1, __ATOMIC_ACQ_REL);
+    cpu_kick(c);
+    pending |= 1L << (c - cpus);
+  }
+  for (c = cpus; c < &cpus[NCPU]; c++) {
+    if ((pending & (1L << (c - cpus))) == 0) continue;
+    // Done once c has flushed after seeing our request.
+    while (__atomic_load_n(&c->tlbdone, __ATOMIC_ACQUIRE) < gen[c - cpus])
+      ;
+  }
+}
+
+pte_t* pgt_walk(pagetable_t pagetable, uint64 va, int alloc);
+
+// Like pgt_deallocunmap(), but safe when sibling threads are running:
+// pages are invalidated first and only freed after the shootdown.
+// Caller must hold uvm->lock.
+static void uvm_deallocunmap(struct uvm* uvm, uint64 vastart, uint64 vaend) {
+  pte_t* pte;
+
+  if (uvm->ref <= 1) {
+    pgt_deallocunmap(uvm->pagetable, vastart, vaend);
+    return;
+  }
+  // Not while a sibling is copying to or from one of the pages.
+  acquire(&uvm->pglock);
+  for (uint64 va = vastart; va < vaend; va += PGSIZE) {
+    if ((pte = pgt_walk(uvm->pagetable, va, 0)) != 0) *pte &= ~PTE_V;
+  }
+  release(&uvm->pglock);
+  uvm_shootdown(uvm);
+  for (uint64 va = vastart; va < vaend; va += PGSIZE) {
+    if ((pte = pgt_walk(uvm->pagetable, va, 0)) != 0 && *pte != 0) {
+      kfree(PTE2PA(*pte));
+      *pte = 0;
+    }
+  }
+}
+
+uint64 uvm_addthread(struct uvm* uvm, uint64 trapframe) {
+  uint64 va = 0;
+
+  acquiresleep(&uvm->lock);
+  for (int t = 1; t < NTHREAD; t++) {
+    if (uvm->threads & (1L << t)) continue;
+    if (pgt_map(uvm->pagetable, TRAPFRAMEN(t), trapframe, PTE_R | PTE_W) == 0) {
+      // Only the supervisor uses it, so not PTE_U.
+      pgt_clearubit(uvm->pagetable, TRAPFRAMEN(t));
+      uvm->threads |= 1L << t;
+      va = TRAPFRAMEN(t);
+    }
+    break;
+  }
+  releasesleep(&uvm->lock);
+  return va;
+}
+
+void uvm_delthread(struct uvm* uvm, uint64 tfva) {
+  acquiresleep(&uvm->lock);
+  pgt_unmap(uvm->pagetable, tfva, tfva + PGSIZE);
+  uvm->threads &= ~(1L << ((TRAPFRAME - tfva) / PGSIZE));
+  releasesleep(&uvm->lock);
+}
+
 // ─────────────────────────────────────────────────────────────────────────────
 // User paging
 // ─────────────────────────────────────────────────────────────────────────────
 
-int uvm_new(struct uvm* uvm, uint64 trapframe) {
+static void vmaunmap(struct uvm* uvm, uint64 addr, uint64 length);
+static uint64 completemap(struct uvm* uvm, uint64 va, uint64 missing_perm);
+
+struct uvm* uvm_new(uint64 trapframe) {
+  struct uvm* uvm;
+
+  if ((uvm = (struct uvm*)kalloc()) == 0) return 0;
   memset(uvm, 0, sizeof(struct uvm));
-  if ((uvm->pagetable = pgt_new()) == 0) return -1;
+  initsleeplock(&uvm->lock, "uvm");
+  initlock(&uvm->pglock, "uvmpg");
+  initsleeplock(&uvm->ringlock, "uring");
+  uvm->ref = 1;
+  if ((uvm->pagetable = pgt_new()) == 0) goto err;
 
   // Map the trampoline code (for system call return)
   // at the highest user virtual address.
   if (pgt_map(uvm->pagetable, TRAMPOLINE, (uint64)trampoline, PTE_R | PTE_X)) {
     pgt_free(uvm->pagetable);
-    uvm->pagetable = 0;
-    return -1;
+    goto err;
   }
   // Only the supervisor uses it, on the way to/from user space, so not PTE_U.
   pgt_clearubit(uvm->pagetable, (uint64)TRAMPOLINE);
 
   // Map the trapframe just below TRAMPOLINE, for trampoline.S.
   if (pgt_map(uvm->pagetable, TRAPFRAME, trapframe, PTE_R | PTE_W)) {
-    pgt_deallocunmap(uvm->pagetable, TRAMPOLINE, TRAMPOLINE + PGSIZE);
+    pgt_unmap(uvm->pagetable, TRAMPOLINE, TRAMPOLINE + PGSIZE);
     pgt_free(uvm->pagetable);
-    uvm->pagetable = 0;
-    return -1;
+    goto err;
   }
   // Only the supervisor uses it, on the way to/from user space, so not PTE_U.
   pgt_clearubit(uvm->pagetable, (uint64)TRAPFRAME);
+  uvm->threads = 1;
 
+  // Map the time page, which user code reads the clock from.
+  if (pgt_map(uvm->pagetable, VDSO, vdso_page, PTE_R)) {
+    pgt_unmap(uvm->pagetable, TRAPFRAME, TRAPFRAME + PGSIZE);
+    pgt_unmap(uvm->pagetable, TRAMPOLINE, TRAMPOLINE + PGSIZE);
+    pgt_free(uvm->pagetable);
+    goto err;
+  }
+  // Like any shared page, it is counted once per mapping, on top of the
+  // reference of vdso.c; so it never looks private to the copy-on-write
+  // path in completemap().
+  kincref(vdso_page);
+
+  return uvm;
+
+err:
+  kfree((uint64)uvm);
   return 0;
 }
 
+struct uvm* uvm_share(struct uvm* uvm) {
+  acquiresleep(&uvm->lock);
+  uvm->ref++;
+  releasesleep(&uvm->lock);
+  return uvm;
+}
+
 void uvm_free(struct uvm* uvm) {
+  acquiresleep(&uvm->lock);
+  int last = --uvm->ref == 0;
+  releasesleep(&uvm->lock);
+  if (!last) return;
+
   for (int i = 0; i < VMA_SIZE; ++i) {
     if (uvm->vma[i]) {
-      uvm_unmap(uvm, uvm->vma[i]->start, uvm->vma[i]->length);
+      vmaunmap(uvm, uvm->vma[i]->start, uvm->vma[i]->length);
     }
   }
   if (uvm->pagetable == 0) panic("uvm_free");
   pgt_unmap(uvm->pagetable, TRAMPOLINE, TRAMPOLINE + PGSIZE);
-  pgt_unmap(uvm->pagetable, TRAPFRAME, TRAPFRAME + PGSIZE);
+  pgt_deallocunmap(uvm->pagetable, VDSO, VDSO + PGSIZE);
+  if (uvm->uring) {
+    pgt_unmap(uvm->pagetable, URING, URING + PGSIZE);
+    kfree(uvm->uring);
+  }
+  for (int t = 0; t < NTHREAD; t++) {
+    if (uvm->threads & (1L << t))
+      pgt_unmap(uvm->pagetable, TRAPFRAMEN(t), TRAPFRAMEN(t) + PGSIZE);
+  }
   pgt_free(uvm->pagetable);
-  uvm->pagetable = 0;
+  kfree((uint64)uvm);
 }
 
 struct vma* uvm_va2vma(struct uvm* uvm, uint64 va) {
@@ -151,7 +283,12 @@ struct vma* uvm_va2vma(struct uvm* uvm, uint64 va) {
   return 0;
 }
 
+// Is [vastart, vastart+length) free for a new vma? Vmas stay below
+// URING: the pages above it are mapped by the kernel itself (see
+// memlayout.h), and have no vma to tell that they are in use.
 int uvm_israngefree(struct uvm* uvm, uint64 vastart, uint64 length) {
+  if (vastart + length < vastart || vastart + length > URING)
+    return 0;
   for (int i = 0; i < VMA_SIZE; ++i) {
     if (uvm->vma[i]) {
       uint64 l = MAX(PGROUNDDOWN(vastart), PGROUNDDOWN(uvm->vma[i]->start));
@@ -170,7 +307,7 @@ uint64 getfreevrange(struct uvm* uvm, int length) {
     // Otherwise, the next address to try shall be
     // the first end of vma higher than vma.
     uint64 previous_addr = addr;
-    addr = MAXVA;
+    addr = URING;
     for (int i = 0; i < VMA_SIZE; ++i) {
       if (uvm->vma[i]) {
         uint64 endvma = PGROUNDUP(uvm->vma[i]->start + uvm->vma[i]->length);
@@ -181,7 +318,7 @@ uint64 getfreevrange(struct uvm* uvm, int length) {
     }
     addr = PGROUNDUP(addr);
     // If there is none, return an error.
-    if (addr + length > MAXVA) break;
+    if (addr + length < addr || addr + length > URING) break;
   }
   return 0;
 }
@@ -191,13 +328,32 @@ uint64 uvm_map(struct uvm* uvm, uint64 addr, uint64 length, uint perm,
   if (inode == 0 && flags != MAP_PRIVATE) return -1;
 
   struct vma* vma;
-  if (!uvm_israngefree(uvm, addr, length)) return -1;
-  if ((vma = vmaalloc(uvm)) == 0) return -1;
+  acquiresleep(&uvm->lock);
+  if (!uvm_israngefree(uvm, addr, length) || (vma = vmaalloc(uvm)) == 0) {
+    releasesleep(&uvm->lock);
+    return -1;
+  }
   vma_init(vma, addr, length, perm, flags, inode, offset, filesz);
+  releasesleep(&uvm->lock);
   return addr;
 }
 
-void uvm_unmap(struct uvm* uvm, uint64 addr, uint64 length) {
+int uvm_unmap(struct uvm* uvm, uint64 addr, uint64 length) {
+  acquiresleep(&uvm->lock);
+  struct vma* vma = uvm_va2vma(uvm, addr);
+  if (vma == 0 ||
+      (addr != vma->start && addr + length != vma->start + vma->length)) {
+    releasesleep(&uvm->lock);
+    return -1;
+  }
+  vmaunmap(uvm, addr, length);
+  releasesleep(&uvm->lock);
+  return 0;
+}
+
+// Unmap part of a vma, see uvm_unmap().
+// Caller must hold uvm->lock, or be its only user.
+static void vmaunmap(struct uvm* uvm, uint64 addr, uint64 length) {
   struct vma* vma = uvm_va2vma(uvm, addr);
   if (vma == 0) panic("uvm_unmap: not in vma!\n");
   if (addr != vma->start && addr + length != vma->start + vma->length)
@@ -224,8 +380,7 @@ void uvm_unmap(struct uvm* uvm, uint64 addr, uint64 length) {
     end_op();
   }
   if (vma->length == length) {
-    pgt_deallocunmap(uvm->pagetable, PGROUNDDOWN(addr),
-                     PGROUNDUP(addr + length));
+    uvm_deallocunmap(uvm, PGROUNDDOWN(addr), PGROUNDUP(addr + length));
     // If range is whole vma, free it.
     for (int i = 0; i < VMA_SIZE; i++) {
       if (vma == uvm->vma[i]) {
@@ -235,22 +390,28 @@ void uvm_unmap(struct uvm* uvm, uint64 addr, uint64 length) {
     }
     vmafree(vma);
   } else if (addr == vma->start) {
-    pgt_deallocunmap(uvm->pagetable, PGROUNDDOWN(addr),
-                     PGROUNDDOWN(addr + length));
+    uvm_deallocunmap(uvm, PGROUNDDOWN(addr), PGROUNDDOWN(addr + length));
     vma->start += length;
     vma->offset += length;
     vma->length -= length;
     vma->filesz = MAX(vma->filesz - length, 0);
   } else {
-    pgt_deallocunmap(uvm->pagetable, PGROUNDUP(addr), PGROUNDUP(addr + length));
+    uvm_deallocunmap(uvm, PGROUNDUP(addr), PGROUNDUP(addr + length));
     vma->length -= length;
     vma->filesz = MIN(vma->filesz, vma->length);
   }
 }
 
-pte_t* pgt_walk(pagetable_t pagetable, uint64 va, int alloc);
-
 uint64 uvm_completemap(struct uvm* uvm, uint64 va, uint64 missing_perm) {
+  acquiresleep(&uvm->lock);
+  uint64 pa = completemap(uvm, va, missing_perm);
+  releasesleep(&uvm->lock);
+  return pa;
+}
+
+// See uvm_completemap().
+// Caller must hold uvm->lock.
+static uint64 completemap(struct uvm* uvm, uint64 va, uint64 missing_perm) {
   if (va % PGSIZE != 0 || va >= MAXVA) return 0;
   struct vma* vma = uvm_va2vma(uvm, va);
   if (!vma || (vma->perm & missing_perm) == 0) return 0;
@@ -269,10 +430,10 @@ uint64 uvm_completemap(struct uvm* uvm, uint64 va, uint64 missing_perm) {
       uint64 eof = vma->start + vma->filesz;
       if (va < eof) {
         uint64 readsz = MIN(eof - va, PGSIZE);
-        ilock(vma->inode);
+        ilock_shared(vma->inode);
         int r =
             readi(vma->inode, 0, pa, vma->offset + (va - vma->start), readsz);
-        iunlock(vma->inode);
+        iunlock_shared(vma->inode);
         if (r != readsz) panic("uvm_completemap: readi");
       }
     }
@@ -282,6 +443,9 @@ uint64 uvm_completemap(struct uvm* uvm, uint64 va, uint64 missing_perm) {
   // If it is valid but it is not a user page return error
   if ((*pte & PTE_U) == 0) return 0;
 
+  // A sibling thread may have handled the same fault first.
+  if (*pte & missing_perm) return PTE2PA(*pte);
+
   if (missing_perm == PTE_W) {
     // If pte did exist and it was a write failure,
     // give write permissions if the physical page
@@ -296,8 +460,14 @@ uint64 uvm_completemap(struct uvm* uvm, uint64 va, uint64 missing_perm) {
     if ((mem = kalloc()) == 0) {
       return 0;
     }
+    // Not while a sibling is copying to the old page, or its write
+    // would be lost.
+    acquire(&uvm->pglock);
     memmove((void*)mem, (void*)pa, PGSIZE);
     *pte = PA2PTE(mem) | PTE_FLAGS(*pte) | PTE_W;
+    release(&uvm->pglock);
+    // Siblings must stop reading the old copy before we let go of it.
+    uvm_shootdown(uvm);
     kfree(pa);
     return mem;
   }
@@ -313,50 +483,66 @@ uint64 uvm_guaranteecomplete(struct uvm* uvm, uint64 va, uint64 minimum_perm) {
   return PTE2PA(*pte);
 }
 
-int uvm_growheap(struct uvm* uvm, int n) {
+uint64 uvm_growheap(struct uvm* uvm, int n) {
+  acquiresleep(&uvm->lock);
   struct vma* heap = uvm->heap;
+  uint64 end = heap->start + heap->length;
   if (n > 0) {
-    uint64 end = heap->start + heap->length;
-    if (end > end + n || end + n > TRAPFRAME) return -1;
+    if (end > end + n || end + n > URING) goto err;
     heap->length += n;
     for (int i = 0; i < VMA_SIZE; ++i) {
       if (!uvm->vma[i] || uvm->vma[i] == heap) continue;
       if (vma_intersect(uvm->heap, uvm->vma[i])) {
         uvm->heap->length -= n;
-        return -1;
+        goto err;
       }
     }
   } else if (n < 0) {
     // Heap takes an extra non used page: see exec.
     // The reason is to avoid having empty vma.
-    if (heap->length - PGSIZE < -n) return -1;
-    uvm_unmap(uvm, heap->start + heap->length + n, -n);
+    if (heap->length - PGSIZE < -n) goto err;
+    vmaunmap(uvm, end + n, -n);
   }
-  return 0;
+  releasesleep(&uvm->lock);
+  return end;
+
+err:
+  releasesleep(&uvm->lock);
+  return -1;
 }
 
 int uvm_dup(struct uvm* p, struct uvm* c) {
+  acquiresleep(&p->lock);
   for (int i = 0; i < VMA_SIZE; i++) {
     if (p->vma[i]) {
       c->vma[i] = vmadup(p->vma[i]);
       if (c->vma[i] == 0) goto err;
-      if (pgt_clone(p->pagetable, c->pagetable, PGROUNDDOWN(p->vma[i]->start),
-                    PGROUNDUP(p->vma[i]->start + p->vma[i]->length)) < 0) {
+      // Not while a sibling is copying to one of the pages: its write
+      // would go to the page the child gets as well.
+      acquire(&p->pglock);
+      int r = pgt_clone(p->pagetable, c->pagetable,
+                        PGROUNDDOWN(p->vma[i]->start),
+                        PGROUNDUP(p->vma[i]->start + p->vma[i]->length));
+      release(&p->pglock);
+      if (r < 0) {
         vmafree(c->vma[i]);
-        acquire(&lock_vmas);            
-        c->vma[i]->used = 0;
-        release(&lock_vmas); 
+        c->vma[i] = 0;
         goto err;
       }
       if (p->vma[i] == p->heap) c->heap = c->vma[i];
     }
   }
+  // The pages of p are now copy-on-write for its threads too.
+  uvm_shootdown(p);
+  releasesleep(&p->lock);
   return 0;
 
 err:
+  uvm_shootdown(p);
+  releasesleep(&p->lock);
   for (int i = 0; i < VMA_SIZE; i++) {
     if (c->vma[i]) {
-      uvm_unmap(c, c->vma[i]->start, c->vma[i]->start + c->vma[i]->length);
+      vmaunmap(c, c->vma[i]->start, c->vma[i]->length);
     }
   }
   return -1;
@@ -376,19 +562,35 @@ void code2uvm(struct uvm* uvm, uchar* src, uint sz) {
   memmove((void*)mem, src, sz);
 }
 
+// Lock uvm->pglock and return the physical address of the user page
+// at va0, if it is mapped with perm, faulting it in if need be; or
+// return 0, unlocked, if it cannot be. The kernel reads and writes the
+// page through its physical address, so the copy must be done before
+// releasing pglock: sibling threads take it to unmap pages or replace
+// them when breaking copy-on-write, and so can't free it meanwhile.
+static uint64 lockpage(struct uvm* uvm, uint64 va0, uint64 perm) {
+  pte_t* pte;
+
+  for (;;) {
+    acquire(&uvm->pglock);
+    pte = pgt_walk(uvm->pagetable, va0, 0);
+    if (pte != 0 && (*pte & PTE_V) && (*pte & PTE_U) && (*pte & perm))
+      return PTE2PA(*pte);
+    release(&uvm->pglock);
+    // A sibling may unmap it again before we look: try again.
+    if (uvm_completemap(uvm, va0, perm) == 0) return 0;
+  }
+}
+
 int copyout(struct uvm* uvm, uint64 dstva, char* src, uint64 len) {
   if (dstva + len < dstva || dstva + len > MAXVA) return -1;
   while (len > 0) {
     uint64 va0 = PGROUNDDOWN(dstva);
-    pte_t* pte = pgt_walk(uvm->pagetable, va0, 0);
     uint64 pa0;
-    if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_W) == 0) {
-      if ((pa0 = uvm_completemap(uvm, va0, PTE_W)) == 0) return -1;
-    } else {
-      pa0 = PTE2PA(*pte);
-    }
+    if ((pa0 = lockpage(uvm, va0, PTE_W)) == 0) return -1;
     uint64 n = MIN(PGSIZE - (dstva - va0), len);
     memmove((void*)(pa0 + (dstva - va0)), src, n);
+    release(&uvm->pglock);
 
     len -= n;
     src += n;
@@ -400,15 +602,14 @@ int copyout(struct uvm* uvm, uint64 dstva, char* src, uint64 len) {
 int copyin(struct uvm* uvm, char* dst, uint64 srcva, uint64 len) {
   uint64 n, va0, pa0;
 
+  if (srcva + len < srcva || srcva + len > MAXVA) return -1;
   while (len > 0) {
     va0 = PGROUNDDOWN(srcva);
-    pa0 = pgt_getpa(uvm->pagetable, va0);
-    if (pa0 == 0) {
-      if ((pa0 = uvm_completemap(uvm, va0, PTE_R)) == 0) return -1;
-    }
+    if ((pa0 = lockpage(uvm, va0, PTE_R)) == 0) return -1;
     n = PGSIZE - (srcva - va0);
     if (n > len) n = len;
     memmove(dst, (void*)(pa0 + (srcva - va0)), n);
+    release(&uvm->pglock);
 
     len -= n;
     dst += n;
@@ -423,10 +624,7 @@ int copyinstr(struct uvm* uvm, char* dst, uint64 srcva, uint64 max) {
 
   while (got_null == 0 && max > 0) {
     va0 = PGROUNDDOWN(srcva);
-    pa0 = pgt_getpa(uvm->pagetable, va0);
-    if (pa0 == 0) {
-      if ((pa0 = uvm_completemap(uvm, va0, PTE_R)) == 0) return -1;
-    }
+    if (va0 >= MAXVA || (pa0 = lockpage(uvm, va0, PTE_R)) == 0) return -1;
     n = PGSIZE - (srcva - va0);
     if (n > max) n = max;
 
@@ -444,6 +642,7 @@ int copyinstr(struct uvm* uvm, char* dst, uint64 srcva, uint64 max) {
       p++;
       dst++;
     }
+    release(&uvm->pglock);
 
     srcva = va0 + PGSIZE;
   }
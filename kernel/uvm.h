@@ -3,6 +3,7 @@
 
 #include "pagetable.h"
 #include "param.h"
+#include "sleeplock.h"
 
 // User memory is defined by Virtual Memory Areas,
 // each indicating a range of directions
@@ -29,10 +30,20 @@ struct vma {
   uint flags;
 };
 
+// The address space of a process, shared by all its threads.
+// Each thread has its own trapframe, mapped at TRAPFRAMEN(slot).
 struct uvm {
+  struct sleeplock lock;      // Protects everything below.
+  int ref;                    // Number of threads using it.
+  uint64 threads;             // Trapframe slots in use (bitmask).
   pagetable_t pagetable;      // User page table
   struct vma* vma[VMA_SIZE];  // Virtual Memory Areas
   struct vma* heap;           // Heap VMA (contained above)
+  struct spinlock pglock;     // Held to remove or replace a page (see
+                              // copyout()), besides lock.
+  struct sleeplock ringlock;  // Protects uring and ringbusy.
+  uint64 uring;               // Page of the system call rings, or 0.
+  int ringbusy;               // SQEs taken whose CQE is not posted yet.
 };
 
 // ─────────────────────────────────────────────────────────────────────────────
@@ -45,18 +56,39 @@ struct uvm {
 void uvminit();
 
 /**
- * Initialize the virtual memory for a user process given its trapframe.
+ * Create the virtual memory for a user process given its trapframe.
  *
  * It adds the trampoline and trapframe pages to the pagetable,
- * but no other memory.
+ * but no other memory. The trapframe is mapped at TRAPFRAME.
+ *
+ * @returns 0 if out of memory.
+ */
+struct uvm* uvm_new(uint64 trapframe);
+
+/**
+ * Add a reference to the user memory, for a new thread.
  */
-int uvm_new(struct uvm* uvm, uint64 trapframe);
+struct uvm* uvm_share(struct uvm* uvm);
 
 /**
- * Free the user memory, unmapping all the virtual memory areas.
+ * Drop a reference to the user memory.
+ * The last one frees it, unmapping all the virtual memory areas.
  */
 void uvm_free(struct uvm* uvm);
 
+/**
+ * Map the trapframe of a new thread in a free slot.
+ *
+ * @returns the virtual address of the trapframe.
+ * @returns 0 if there is no free slot or out of memory.
+ */
+uint64 uvm_addthread(struct uvm* uvm, uint64 trapframe);
+
+/**
+ * Unmap the trapframe of a thread, without freeing it.
+ */
+void uvm_delthread(struct uvm* uvm, uint64 tfva);
+
 /**
  * Locate the process' vma associated to a virtual address.
  */
@@ -77,11 +109,15 @@ uint64 uvm_map(struct uvm* uvm, uint64 addr, uint64 length, uint perm,
  * If the VMA is backed by a disk file and the flags is `MAP_SHARED`,
  * this function writes the modifications back to the file.
  * If the portion is the whole VMA, then the VMA is deleted.
+ *
+ * @returns 0 on success.
+ * @returns -1 if the range is not the start or the end of a vma.
  */
-void uvm_unmap(struct uvm* uvm, uint64 addr, uint64 length);
+int uvm_unmap(struct uvm* uvm, uint64 addr, uint64 length);
 
 /**
  * Handles a pagefault of the current process at address va.
+ * Must not be called while holding a spinlock.
  *
  * @returns the physical address of the new page.
  * @returns 0 if lack of memory or the page fault is due to wrong access.
@@ -100,10 +136,10 @@ uint64 uvm_guaranteecomplete(struct uvm* uvm, uint64 va, uint64 minimum_perm);
 /**
  * Grow or shrink user memory by n bytes.
  *
- * @returns 0 on success
+ * @returns the previous end of the heap.
  * @returns -1 on failure.
  */
-int uvm_growheap(struct uvm* uvm, int n);
+uint64 uvm_growheap(struct uvm* uvm, int n);
 
 /**
  * Duplicate the user virtual memory of the parent for the child,
@@ -0,0 +1,56 @@
+// The time page (vDSO).
+//
+// A page shared read-only by every process (see uvm_new()), with the
+// frequency of the time CSR and a snapshot of the clock taken at the
+// clock ticks. User code reads the time CSR itself, as scounteren
+// allows it to, and clock_gettime() in ulib.c extrapolates from the
+// snapshot: no ecall, no trip through the trampoline.
+//
+// The snapshot is written under a sequence count (a seqlock): the
+// writer makes seq odd, updates it and makes seq even again, and a
+// reader retries until it sees the same even seq before and after
+// reading it. Readers never block the writer, and only the harts
+// taking a tick write, one at a time under vdso_lock. A hart that is
+// tickless does not update it, but the extrapolation from an old
+// snapshot is just as good.
+
+#include "defs.h"
+#include "kalloc.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "types.h"
+#include "vdso.h"
+
+uint64 vdso_page;
+static struct vdso *vdso;
+static struct spinlock vdso_lock;
+
+// Allocate the time page. Its reference is never dropped; every
+// uvm that maps it holds one more.
+void vdsoinit(void) {
+  if ((vdso_page = kalloc()) == 0) panic("vdsoinit");
+  vdso = (struct vdso *)vdso_page;
+  memset(vdso, 0, PGSIZE);
+  initlock(&vdso_lock, "vdso");
+  vdso->freq = MTIME_FREQ;
+  vdso->tick_cycles = TICK_CYCLES;
+}
+
+// Called by a hart taking a clock tick at mtime now:
+// bring the snapshot up to date, unless another hart has done it.
+void vdso_tick(uint64 now) {
+  uint64 ticks = now / TICK_CYCLES;
+
+  if (__atomic_load_n(&vdso->ticks, __ATOMIC_RELAXED) >= ticks) return;
+  acquire(&vdso_lock);
+  if (vdso->ticks < ticks) {
+    __atomic_store_n(&vdso->seq, vdso->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&vdso->ticks, ticks, __ATOMIC_RELAXED);
+    __atomic_store_n(&vdso->tickstamp, ticks * TICK_CYCLES,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&vdso->seq, vdso->seq + 1, __ATOMIC_RELEASE);
+  }
+  release(&vdso_lock);
+}
@@ -0,0 +1,29 @@
+#ifndef VDSO_H_
+#define VDSO_H_
+
+#include "types.h"
+
+// The time page, mapped read-only at VDSO (see memlayout.h) in every
+// process, so that user code can read the clock without a system
+// call: it holds what it takes to turn the time CSR, which user mode
+// may read, into a time of day.
+struct vdso {
+  uint64 freq;         // Frequency of the time CSR, Hz.
+  uint64 tick_cycles;  // Time CSR cycles per clock tick.
+
+  // Updated at clock ticks. seq is odd while they change: a reader
+  // must retry if it was odd, or is no longer the same, afterwards.
+  uint seq;
+  uint64 ticks;        // Clock ticks since boot, as of the snapshot.
+  uint64 tickstamp;    // Time CSR when the last of them was due.
+};
+
+// Clocks of clock_gettime().
+#define CLOCK_MONOTONIC 1  // Time since boot.
+
+struct timespec {
+  uint64 tv_sec;
+  uint64 tv_nsec;
+};
+
+#endif
@@ -0,0 +1,141 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/cpustat.h"
+#include "kernel/pstat.h"
+#include "user/user.h"
+
+// Tests of sched_setaffinity().
+
+void mask_test();
+void inherit_test();
+void pin_test();
+
+int
+main(int argc, char *argv[])
+{
+  mask_test();
+  inherit_test();
+  pin_test();
+  printf("affinitytest: all tests succeeded\n");
+  exit(0);
+}
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("affinitytest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+//
+// a mask must include an online hart.
+//
+void
+mask_test()
+{
+  struct cpustat cs;
+
+  testname = "mask_test";
+  if (getcpuinfo(&cs) < 0)
+    err("getcpuinfo");
+  if (sched_setaffinity(0, 0) >= 0)
+    err("accepted an empty mask");
+  for (int i = 0; i < NCPU; i++) {
+    if (!cs.online[i] && sched_setaffinity(0, 1 << i) >= 0)
+      err("accepted an offline hart");
+  }
+  if (sched_setaffinity(1 << 30, -1) >= 0)
+    err("accepted a bad pid");
+  if (sched_setaffinity(0, 1) < 0 || sched_setaffinity(0, -1) < 0)
+    err("sched_setaffinity");
+
+  printf("mask_test OK\n");
+}
+
+//
+// a child inherits the mask, and getpinfo() reports it.
+//
+void
+inherit_test()
+{
+  static struct pstat ps;
+  int pid, xstatus;
+
+  testname = "inherit_test";
+  if (sched_setaffinity(0, 1) < 0)
+    err("sched_setaffinity");
+  pid = fork();
+  if (pid < 0)
+    err("fork");
+  if (pid == 0) {
+    if (getpinfo(&ps) < 0)
+      err("getpinfo");
+    for (int i = 0; i < NPROC; i++) {
+      if (ps.inuse[i] && ps.pid[i] == getpid())
+        exit(ps.affinity[i] == 1 ? 0 : 1);
+    }
+    exit(2);
+  }
+  if (sched_setaffinity(0, -1) < 0)
+    err("sched_setaffinity");
+  if (wait(&xstatus) != pid)
+    err("wait");
+  if (xstatus != 0)
+    err(xstatus == 1 ? "mask not inherited" : "child not reported");
+
+  printf("inherit_test OK\n");
+}
+
+//
+// processes restricted to hart 0 leave the others idle,
+// even though they could steal them.
+//
+void
+pin_test()
+{
+  struct cpustat before, after;
+  int n = 0, t0;
+
+  testname = "pin_test";
+  if (getcpuinfo(&before) < 0)
+    err("getcpuinfo");
+  for (int i = 0; i < NCPU; i++)
+    n += before.online[i];
+  if (n < 2) {
+    printf("pin_test skipped: a single hart\n");
+    return;
+  }
+
+  t0 = uptime();
+  if (sched_setaffinity(0, 1) < 0)
+    err("sched_setaffinity");
+  for (int i = 0; i < n; i++) {
+    int pid = fork();
+    if (pid < 0)
+      err("fork");
+    if (pid == 0) {
+      while (uptime() < t0 + 10)
+        ;
+      exit(0);
+    }
+  }
+  if (sched_setaffinity(0, -1) < 0)
+    err("sched_setaffinity");
+  for (int i = 0; i < n; i++) {
+    if (wait(0) < 0)
+      err("wait");
+  }
+  if (getcpuinfo(&after) < 0)
+    err("getcpuinfo");
+
+  for (int i = 1; i < NCPU; i++) {
+    if (after.online[i] &&
+        (after.idle[i] - before.idle[i]) * 100 / (after.time - before.time) <
+            75)
+      err("a process ran on another hart");
+  }
+
+  printf("pin_test OK\n");
+}
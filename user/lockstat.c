@@ -0,0 +1,97 @@
+#include "kernel/lockstat.h"
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Show the most contended spinlocks, in a kernel built with
+// make LOCKSTAT=1:
+//   lockstat [-n count] [command [args...]]
+// With a command, the statistics are cleared first and cover its run;
+// without, they cover everything since boot. A site is the return
+// address of an acquire() call, to be looked up in kernel/kernel.asm.
+
+static struct lockstat st[NLOCKSTAT];
+
+// Print v right-aligned in a field of width characters.
+static void putnum(uint64 v, int width) {
+  char buf[24];
+  int i = sizeof(buf);
+
+  buf[--i] = 0;
+  do {
+    buf[--i] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  for (int n = sizeof(buf) - 1 - i; n < width; n++) printf(" ");
+  printf("%s", buf + i);
+}
+
+static uint64 usecs(uint64 cycles) { return cycles / (MTIME_FREQ / 1000000); }
+
+// Does a come before b: more time spun, then more contention?
+static int before(struct lockstat *a, struct lockstat *b) {
+  if (a->spin != b->spin) return a->spin > b->spin;
+  return a->contended > b->contended;
+}
+
+static void report(int top) {
+  struct lockstat t;
+  int n, i, j;
+
+  if ((n = getlockstat(st, NLOCKSTAT)) < 0) {
+    fprintf(2, "lockstat: kernel built without LOCKSTAT\n");
+    exit(1);
+  }
+  for (i = 1; i < n; i++) {
+    t = st[i];
+    for (j = i; j > 0 && before(&t, &st[j - 1]); j--) st[j] = st[j - 1];
+    st[j] = t;
+  }
+
+  printf("name             site         acquires  contended    spin us maxhold us\n");
+  for (i = 0; i < n && i < top; i++) {
+    if (st[i].acquires == 0) break;
+    int len = strlen(st[i].name);
+    printf("%s", st[i].name);
+    for (; len < 16; len++) printf(" ");
+    printf(" %x", (int)st[i].site);
+    putnum(st[i].acquires, 11);
+    putnum(st[i].contended, 11);
+    putnum(usecs(st[i].spin), 11);
+    putnum(usecs(st[i].maxhold), 11);
+    printf("\n");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int top = 10, pid;
+
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    top = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
+  if (argc < 2) {
+    report(top);
+    exit(0);
+  }
+
+  if (getlockstat(0, 0) < 0) {
+    fprintf(2, "lockstat: kernel built without LOCKSTAT\n");
+    exit(1);
+  }
+  if ((pid = fork()) < 0) {
+    fprintf(2, "lockstat: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    exec(argv[1], argv + 1);
+    fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  while (wait(0) != pid)
+    ;
+  report(top);
+  exit(0);
+}
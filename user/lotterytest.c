@@ -1,5 +1,6 @@
 #include "kernel/types.h"
 #include "kernel/pstat.h"
+#include "kernel/sched.h"
 #include "user/user.h"
 #include "kernel/stat.h"
 
@@ -20,11 +21,12 @@ void printpinfo(int* pid, int npids) {
   struct pstat pi;
   int i;
   getpinfo(&pi);
-  printf("%s\t%s\t\t%s\n", "PID", "TICKETS", "TICKS");
+  printf("%s\t%s\t\t%s\t%s\n", "PID", "TICKETS", "EFF", "TICKS");
   for (i = 0; i < NPROC; i++) {
     for (int j = 0; j < npids; ++j) {
       if (pi.pid[i] == pid[j]) {
-        printf("%d\t%d\t\t%d\n", pi.pid[i], pi.tickets[i], pi.ticks[i]);
+        printf("%d\t%d\t\t%d\t%d\n", pi.pid[i], pi.tickets[i],
+               pi.efftickets[i], pi.ticks[i]);
       }
     }
   }
@@ -38,6 +40,12 @@ int main(int argc, char *argv[]) {
   int work[3] = {48, 24, 16};
   settickets(100);
 
+  // lotterytest [rebalance interval in ticks] [lottery|stride]
+  if (argc > 1) schedctl(SCHED_REBALANCE, atoi(argv[1]));
+  if (argc > 2)
+    schedctl(SCHED_POLICY,
+             strcmp(argv[2], "stride") == 0 ? SCHED_STRIDE : SCHED_LOTTERY);
+
   for (int i = 0; i < npids; ++i) {
     if ((pid[i] = fork()) == 0) {
       int pid = getpid();
@@ -0,0 +1,65 @@
+#include "kernel/types.h"
+#include "kernel/sched.h"
+#include "user/user.h"
+
+// pingpong [round trips]: bounce a byte between two processes over a
+// pair of pipes, with and without direct process-to-process switches,
+// and report how long it takes.
+
+int
+bounce(int n)
+{
+  int ping[2], pong[2];
+  int pid, t0;
+  char c = 0;
+
+  if (pipe(ping) < 0 || pipe(pong) < 0) {
+    printf("pingpong: pipe failed\n");
+    exit(1);
+  }
+  if ((pid = fork()) < 0) {
+    printf("pingpong: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    close(ping[1]);
+    close(pong[0]);
+    while (read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit(0);
+  }
+  close(ping[0]);
+  close(pong[1]);
+  t0 = uptime();
+  for (int i = 0; i < n; i++) {
+    if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1) {
+      printf("pingpong: lost the ball\n");
+      exit(1);
+    }
+  }
+  t0 = uptime() - t0;
+  close(ping[1]);
+  close(pong[0]);
+  wait(0);
+  return t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 10000;
+  int old, direct, indirect;
+
+  if (argc > 1)
+    n = atoi(argv[1]);
+
+  old = schedctl(SCHED_DIRECT, 0);
+  indirect = bounce(n);
+  schedctl(SCHED_DIRECT, 1);
+  direct = bounce(n);
+  schedctl(SCHED_DIRECT, old);
+
+  printf("%d round trips: %d ticks via the scheduler, %d ticks direct\n",
+         n, indirect, direct);
+  exit(0);
+}
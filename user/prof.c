@@ -0,0 +1,134 @@
+#include "kernel/fcntl.h"
+#include "kernel/file.h"
+#include "kernel/prof.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Profile a command with the sampling profiler:
+//   prof [-f hz] command [args...]
+// Prints a line "@pid <pid> <command>" and then every sample taken on
+// any hart while the command runs, as a line
+//   @ <cpu> <pid> <k|u> <pc> <return address>...
+// in hex. user/profsym.pl turns the lines into a flat profile or
+// folded stacks, from a log of the console.
+
+static struct profsample samples[32];
+static char line[32 + PROF_DEPTH * 17];
+
+// Append v to s in hex, after a space.
+static char *puthex(char *s, uint64 v) {
+  char buf[16];
+  int i = 0;
+
+  *s++ = ' ';
+  do {
+    buf[i++] = "0123456789abcdef"[v % 16];
+    v /= 16;
+  } while (v);
+  while (i > 0) *s++ = buf[--i];
+  return s;
+}
+
+// Print the samples of n bytes of samples[], a write() each,
+// so that they are not broken up by the output of the command.
+static void print(int n) {
+  for (struct profsample *s = samples; s < samples + n / sizeof(*s); s++) {
+    char *e = line;
+    *e++ = '@';
+    e = puthex(e, s->cpu);
+    e = puthex(e, s->pid);
+    *e++ = ' ';
+    *e++ = s->mode == PROF_USER ? 'u' : 'k';
+    for (int i = 0; i < s->depth; i++) e = puthex(e, s->pc[i]);
+    *e++ = '\n';
+    write(1, line, e - line);
+  }
+}
+
+// Copy out the samples until profiling stops and they are all read.
+static void drain(int fd) {
+  int n, stopped;
+
+  for (;;) {
+    stopped = profctl(-1) == 0;
+    if ((n = read(fd, samples, sizeof(samples))) < 0) {
+      fprintf(2, "prof: read failed\n");
+      exit(1);
+    }
+    if (n > 0)
+      print(n);
+    else if (stopped)
+      break;
+    else
+      nanosleep(10000000);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int hz = 1000, fd, fds[2], pid, drainer;
+
+  if (argc > 2 && strcmp(argv[1], "-f") == 0) {
+    hz = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc < 2 || hz <= 0) {
+    fprintf(2, "usage: prof [-f hz] command [args...]\n");
+    exit(1);
+  }
+
+  if ((fd = open("/prof", O_RDONLY)) < 0) {
+    mknod("/prof", PROF, 0);
+    fd = open("/prof", O_RDONLY);
+  }
+  if (fd < 0) {
+    fprintf(2, "prof: cannot open /prof\n");
+    exit(1);
+  }
+  // Throw away what is left of an earlier run.
+  while (read(fd, samples, sizeof(samples)) > 0)
+    ;
+
+  // The drainer only starts printing once it knows the pid of the
+  // command, through the pipe.
+  if (pipe(fds) < 0) {
+    fprintf(2, "prof: pipe failed\n");
+    exit(1);
+  }
+  if ((drainer = fork()) < 0) {
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if (drainer == 0) {
+    close(fds[1]);
+    if (read(fds[0], &pid, sizeof(pid)) != sizeof(pid)) exit(1);
+    printf("@pid %d %s\n", pid, argv[1]);
+    drain(fd);
+    exit(0);
+  }
+  close(fds[0]);
+
+  if (profctl(hz) < 0) {
+    fprintf(2, "prof: cannot sample at %d hz\n", hz);
+    kill(drainer);
+    exit(1);
+  }
+  if ((pid = fork()) < 0) {
+    fprintf(2, "prof: fork failed\n");
+    profctl(0);
+    kill(drainer);
+    exit(1);
+  }
+  if (pid == 0) {
+    exec(argv[1], argv + 1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  write(fds[1], &pid, sizeof(pid));
+  close(fds[1]);
+  while (wait(0) != pid)
+    ;
+  profctl(0);
+  wait(0);
+  exit(0);
+}
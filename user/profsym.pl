@@ -0,0 +1,87 @@
+#!/usr/bin/perl -w
+
+# Symbolize the samples printed by prof (see user/prof.c), from a log
+# of the console, run from the top of the tree after make:
+#   perl user/profsym.pl [-f] [log]
+# Prints a flat profile, samples by function and mode, or with -f the
+# folded stacks, "frame;frame;... count" outermost frame first, as
+# flamegraph.pl takes them. Kernel pcs are looked up in kernel/kernel.sym,
+# user ones of the profiled command in user/<command>.sym; other
+# processes are only told apart by pid, and pid 0 is the scheduler.
+
+use strict;
+
+my $folded = 0;
+if (@ARGV && $ARGV[0] eq "-f") {
+    $folded = 1;
+    shift;
+}
+
+# Function symbols of a .sym file, as [address, name] sorted by address.
+sub readsyms {
+    my $file = shift;
+    my @syms;
+    open(my $fh, "<", $file) or die "profsym: cannot open $file\n";
+    while (<$fh>) {
+        my ($addr, $name) = split;
+        next unless defined $name;
+        # Sections, files and local labels.
+        next if $name =~ /^\./ || $name =~ /\.[cSo]$/ || $name =~ /^\$/;
+        push @syms, [hex($addr), $name];
+    }
+    close($fh);
+    return [sort { $a->[0] <=> $b->[0] } @syms];
+}
+
+# Name of the function holding pc in syms.
+sub lookup {
+    my ($syms, $pc) = @_;
+    my ($lo, $hi) = (0, scalar(@$syms) - 1);
+    return sprintf("0x%x", $pc) if $hi < 0 || $pc < $syms->[0][0];
+    while ($lo < $hi) {
+        my $mid = int(($lo + $hi + 1) / 2);
+        if ($syms->[$mid][0] <= $pc) {
+            $lo = $mid;
+        } else {
+            $hi = $mid - 1;
+        }
+    }
+    return $syms->[$lo][1];
+}
+
+my $ksyms = readsyms("kernel/kernel.sym");
+my ($cmdpid, $cmd, $usyms) = (-1, "", []);
+my (%flat, %stacks);
+my $total = 0;
+
+while (<>) {
+    if (/\@pid (\d+) (\S+)/) {
+        ($cmdpid, $cmd) = ($1, $2);
+        (my $base = $cmd) =~ s{.*/}{};
+        $usyms = readsyms("user/$base.sym") if -e "user/$base.sym";
+        next;
+    }
+    next unless /\@ ([0-9a-f]+) ([0-9a-f]+) ([ku])((?: [0-9a-f]+)+)/;
+    my ($pid, $mode, @pcs) = (hex($2), $3, map { hex } split(' ', $4));
+    my $syms = $mode eq "k" ? $ksyms : $pid == $cmdpid ? $usyms : [];
+    my @frames;
+    for (my $i = 0; $i < @pcs; $i++) {
+        # A return address follows the call, which may end the function.
+        my $f = lookup($syms, $i ? $pcs[$i] - 1 : $pcs[$i]);
+        push @frames, $mode eq "k" ? "${f}_[k]" : $f;
+    }
+    $flat{$frames[0]}++;
+    my $who = $pid == 0 ? "scheduler" : $pid == $cmdpid ? $cmd : "pid $pid";
+    $stacks{join(";", $who, reverse @frames)}++;
+    $total++;
+}
+
+die "profsym: no samples\n" unless $total;
+if ($folded) {
+    print "$_ $stacks{$_}\n" foreach sort keys %stacks;
+} else {
+    printf("%7s %6s  %s\n", "samples", "%", "function");
+    foreach my $f (sort { $flat{$b} <=> $flat{$a} || $a cmp $b } keys %flat) {
+        printf("%7d %6.2f  %s\n", $flat{$f}, 100 * $flat{$f} / $total, $f);
+    }
+}
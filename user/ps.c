@@ -1,16 +1,37 @@
+#include "kernel/cpustat.h"
 #include "kernel/pstat.h"
 #include "kernel/types.h"
 #include "user/user.h"
 
 int main(int argc, char *argv[]) {
   struct pstat procstatus;
+  struct cpustat cpustatus;
   getpinfo(&procstatus);
+  getcpuinfo(&cpustatus);
 
-  printf("%s\t%s\t\t%s\n", "PID", "TICKETS", "TICKS");
+  printf("%s\t%s\t\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n", "PID", "TICKETS",
+         "CUR", "EFF", "RT", "CPUS", "TICKS", "USER", "SYS");
   for (int i = 0; i < NPROC; i++) {
     if (procstatus.inuse[i]) {
-      printf("%d\t%d\t\t%d\n", procstatus.pid[i], procstatus.tickets[i],
-             procstatus.ticks[i]);
+      // Times in ms.
+      printf("%d\t%d\t\t%d\t%d\t%d\t%x\t%d\t%d\t%d\n",
+             procstatus.pid[i], procstatus.tickets[i],
+             procstatus.currency[i], procstatus.efftickets[i],
+             procstatus.rtprio[i], (int)procstatus.affinity[i],
+             procstatus.ticks[i],
+             (int)(procstatus.utime[i] / (MTIME_FREQ / 1000)),
+             (int)(procstatus.stime[i] / (MTIME_FREQ / 1000)));
+    }
+  }
+
+  printf("\n%s\t%s\t%s\t%s\t%s\n", "CPU", "IDLE", "TICKS", "SLSPIN",
+         "SLSLEEP");
+  for (int i = 0; i < NCPU; i++) {
+    if (cpustatus.online[i]) {
+      printf("%d\t%d%%\t%d\t%d\t%d\n", i,
+             (int)(cpustatus.idle[i] * 100 / cpustatus.time),
+             (int)cpustatus.ticks[i], (int)cpustatus.slspin[i],
+             (int)cpustatus.slsleep[i]);
     }
   }
   exit(0);
@@ -0,0 +1,89 @@
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/vdso.h"
+#include "user/user.h"
+
+// Measure how reads of a cached file scale with the number of readers:
+//   readbench [maxprocs [passes]]
+// With 1, 2, 4... up to maxprocs (NCPU by default) processes, each
+// reads all of a small file passes times, and the total throughput is
+// printed. The file fits in the buffer cache, so after the first pass
+// this exercises bget() and brelse() rather than the disk.
+
+#define FILEBLOCKS 8
+
+static char *file = "readbench.tmp";
+static char buf[BSIZE];
+
+static uint64 msecs(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+    fprintf(2, "readbench: clock_gettime failed\n");
+    exit(1);
+  }
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void reader(int passes) {
+  int fd;
+
+  for (int i = 0; i < passes; i++) {
+    if ((fd = open(file, O_RDONLY)) < 0) {
+      fprintf(2, "readbench: open %s failed\n", file);
+      exit(1);
+    }
+    while (read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  int maxprocs = NCPU, passes = 200, fd;
+  uint64 start, ms;
+
+  if (argc > 1) maxprocs = atoi(argv[1]);
+  if (argc > 2) passes = atoi(argv[2]);
+  if (maxprocs < 1 || passes < 1) {
+    fprintf(2, "usage: readbench [maxprocs [passes]]\n");
+    exit(1);
+  }
+
+  if ((fd = open(file, O_CREATE | O_RDWR)) < 0) {
+    fprintf(2, "readbench: create %s failed\n", file);
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  for (int i = 0; i < FILEBLOCKS; i++) {
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+      fprintf(2, "readbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  printf("procs\tms\tKB/s\n");
+  for (int n = 1; n <= maxprocs; n *= 2) {
+    start = msecs();
+    for (int i = 0; i < n; i++) {
+      int pid = fork();
+      if (pid < 0) {
+        fprintf(2, "readbench: fork failed\n");
+        exit(1);
+      }
+      if (pid == 0) reader(passes);
+    }
+    for (int i = 0; i < n; i++) wait(0);
+    ms = msecs() - start;
+    printf("%d\t%d\t%d\n", n, (int)ms,
+           (int)((uint64)n * passes * FILEBLOCKS * (BSIZE / 1024) * 1000 /
+                 (ms ? ms : 1)));
+  }
+
+  unlink(file);
+  exit(0);
+}
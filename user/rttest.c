@@ -0,0 +1,172 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/cpustat.h"
+#include "kernel/sched.h"
+#include "user/user.h"
+
+// Tests of the real-time (SCHED_FIFO) scheduling class.
+// The spinners take every online hart, so run it on an otherwise
+// idle system.
+
+void attr_test();
+void preempt_test();
+void budget_test();
+
+int
+main(int argc, char *argv[])
+{
+  attr_test();
+  preempt_test();
+  budget_test();
+  printf("rttest: all tests succeeded\n");
+  exit(0);
+}
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("rttest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+int
+setclass(int pid, int policy, int priority)
+{
+  struct sched_attr attr;
+
+  attr.policy = policy;
+  attr.priority = priority;
+  return sched_setattr(pid, &attr);
+}
+
+int
+ncpus()
+{
+  struct cpustat cs;
+  int n = 0;
+
+  if (getcpuinfo(&cs) < 0)
+    err("getcpuinfo");
+  for (int i = 0; i < NCPU; i++)
+    n += cs.online[i];
+  return n;
+}
+
+// Start n children that spin until uptime() reaches end,
+// in the class given. The caller must outrank them.
+void
+spinners(int n, int policy, int priority, int end)
+{
+  for (int i = 0; i < n; i++) {
+    int pid = fork();
+    if (pid < 0)
+      err("fork");
+    if (pid == 0) {
+      if (setclass(0, policy, priority) < 0)
+        err("sched_setattr");
+      while (uptime() < end)
+        ;
+      exit(0);
+    }
+  }
+}
+
+void
+waitall(int n)
+{
+  for (int i = 0; i < n; i++) {
+    if (wait(0) < 0)
+      err("wait");
+  }
+}
+
+//
+// sched_setattr() checks its arguments.
+//
+void
+attr_test()
+{
+  testname = "attr_test";
+  if (setclass(0, SCHED_FIFO, 0) >= 0)
+    err("accepted priority 0");
+  if (setclass(0, SCHED_FIFO, RTPRIO_MAX + 1) >= 0)
+    err("accepted too high a priority");
+  if (setclass(0, SCHED_NORMAL, 1) >= 0)
+    err("accepted a priority for SCHED_NORMAL");
+  if (setclass(0, 7, 1) >= 0)
+    err("accepted a bad policy");
+  if (setclass(1 << 30, SCHED_NORMAL, 0) >= 0)
+    err("accepted a bad pid");
+  if (setclass(0, SCHED_FIFO, 1) < 0 || setclass(0, SCHED_NORMAL, 0) < 0)
+    err("sched_setattr");
+
+  printf("attr_test OK\n");
+}
+
+//
+// a real-time process that wakes up runs at once,
+// even with every hart busy with normal processes.
+//
+void
+preempt_test()
+{
+  int n = ncpus(), t0, t1;
+
+  testname = "preempt_test";
+  if (setclass(0, SCHED_FIFO, 10) < 0)
+    err("sched_setattr");
+  t0 = uptime();
+  spinners(n, SCHED_NORMAL, 0, t0 + 20);
+  t1 = uptime();
+  for (int i = 0; i < 10; i++)
+    sleep(1);
+  // waking up at the next tick instead would take up to 20.
+  if (uptime() - t1 > 13)
+    err("woke up late");
+  if (setclass(0, SCHED_NORMAL, 0) < 0)
+    err("sched_setattr");
+  waitall(n);
+
+  printf("preempt_test OK\n");
+}
+
+//
+// real-time processes leave normal ones their share of the CPU
+// beyond the budget, and starve them without one.
+//
+void
+budget_test()
+{
+  int n = ncpus(), t0, old;
+
+  testname = "budget_test";
+
+  // A normal process waiting runs within a period or so.
+  if (setclass(0, SCHED_FIFO, 20) < 0)
+    err("sched_setattr");
+  t0 = uptime();
+  spinners(n, SCHED_FIFO, 10, t0 + 3 * RT_PERIOD);
+  if (setclass(0, SCHED_NORMAL, 0) < 0)
+    err("sched_setattr");
+  if (uptime() - t0 >= 3 * RT_PERIOD)
+    err("normal process starved");
+  waitall(n);
+
+  // With all of the CPU, not until they are done.
+  if ((old = schedctl(SCHED_RTBUDGET, 100)) < 0)
+    err("schedctl");
+  if (setclass(0, SCHED_FIFO, 20) < 0)
+    err("sched_setattr");
+  t0 = uptime();
+  spinners(n, SCHED_FIFO, 10, t0 + 2 * RT_PERIOD);
+  if (setclass(0, SCHED_NORMAL, 0) < 0)
+    err("sched_setattr");
+  if (uptime() - t0 < 2 * RT_PERIOD)
+    err("ran over a budget of 100%");
+  waitall(n);
+  schedctl(SCHED_RTBUDGET, old);
+
+  printf("budget_test OK\n");
+}
@@ -0,0 +1,177 @@
+#include "kernel/param.h"
+#include "kernel/scstat.h"
+#include "kernel/syscall.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Summarize the system calls made by a command, like strace -c:
+//   strace [-h] command [args...]
+// or, without a command, those made on all harts since boot.
+// -h adds the latency histogram of each system call.
+
+static char *names[NSYSCALL] = {
+    [SYS_fork] "fork",
+    [SYS_exit] "exit",
+    [SYS_wait] "wait",
+    [SYS_pipe] "pipe",
+    [SYS_read] "read",
+    [SYS_kill] "kill",
+    [SYS_exec] "exec",
+    [SYS_fstat] "fstat",
+    [SYS_chdir] "chdir",
+    [SYS_dup] "dup",
+    [SYS_getpid] "getpid",
+    [SYS_sbrk] "sbrk",
+    [SYS_sleep] "sleep",
+    [SYS_uptime] "uptime",
+    [SYS_open] "open",
+    [SYS_write] "write",
+    [SYS_mknod] "mknod",
+    [SYS_unlink] "unlink",
+    [SYS_link] "link",
+    [SYS_mkdir] "mkdir",
+    [SYS_close] "close",
+    [SYS_settickets] "settickets",
+    [SYS_getpinfo] "getpinfo",
+    [SYS_mmap] "mmap",
+    [SYS_munmap] "munmap",
+    [SYS_schedctl] "schedctl",
+    [SYS_getcpuinfo] "getcpuinfo",
+    [SYS_clone] "clone",
+    [SYS_join] "join",
+    [SYS_futex_wait] "futex_wait",
+    [SYS_futex_wake] "futex_wake",
+    [SYS_nanosleep] "nanosleep",
+    [SYS_mkcurrency] "mkcurrency",
+    [SYS_setcurrency] "setcurrency",
+    [SYS_wait2] "wait2",
+    [SYS_sched_setattr] "sched_setattr",
+    [SYS_sched_setaffinity] "sched_setaffinity",
+    [SYS_uring_setup] "uring_setup",
+    [SYS_uring_enter] "uring_enter",
+    [SYS_getscstat] "getscstat",
+    [SYS_profctl] "profctl",
+    [SYS_getlockstat] "getlockstat",
+    [SYS_waitscstat] "waitscstat",
+};
+
+static struct scstat st, cpust;
+
+// Print v right-aligned in a field of width characters.
+static void putnum(uint64 v, int width) {
+  char buf[24];
+  int i = sizeof(buf);
+
+  buf[--i] = 0;
+  do {
+    buf[--i] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  for (int n = sizeof(buf) - 1 - i; n < width; n++) printf(" ");
+  printf("%s", buf + i);
+}
+
+static uint64 usecs(uint64 cycles) { return cycles / (MTIME_FREQ / 1000000); }
+
+static void histogram(int num) {
+  uint max = 0;
+
+  for (int b = 0; b < NSCHIST; b++) {
+    if (st.hist[num][b] > max) max = st.hist[num][b];
+  }
+  for (int b = 0; b < NSCHIST; b++) {
+    if (st.hist[num][b] == 0) continue;
+    // Lower bound of the bucket, in ns.
+    printf("    >=");
+    putnum(b == 0 ? 0 : ((uint64)1 << b) * (1000000000 / MTIME_FREQ), 9);
+    printf("ns ");
+    putnum(st.hist[num][b], 8);
+    printf(" ");
+    for (int i = 0; i < (st.hist[num][b] * 40 + max - 1) / max; i++)
+      printf("*");
+    printf("\n");
+  }
+}
+
+static void summary(int hist) {
+  uint64 total = 0, calls = 0;
+  int order[NSYSCALL], n = 0;
+
+  // Busiest first.
+  for (int i = 0; i < NSYSCALL; i++) {
+    if (st.count[i] == 0) continue;
+    int j = n++;
+    for (; j > 0 && st.cycles[order[j - 1]] < st.cycles[i]; j--)
+      order[j] = order[j - 1];
+    order[j] = i;
+    total += st.cycles[i];
+    calls += st.count[i];
+  }
+
+  printf("%% time      usecs usecs/call     calls syscall\n");
+  printf("------ ---------- ---------- --------- ----------------\n");
+  for (int k = 0; k < n; k++) {
+    int i = order[k];
+    uint64 permille = total ? st.cycles[i] * 1000 / total : 0;
+    putnum(permille / 10, 4);
+    printf(".%d ", (int)(permille % 10));
+    putnum(usecs(st.cycles[i]), 10);
+    printf(" ");
+    putnum(usecs(st.cycles[i]) / st.count[i], 10);
+    printf(" ");
+    putnum(st.count[i], 9);
+    printf(" %s\n", names[i] ? names[i] : "?");
+    if (hist) histogram(i);
+  }
+  printf("------ ---------- ---------- --------- ----------------\n");
+  printf("100.0 ");
+  putnum(usecs(total), 10);
+  printf("            ");
+  putnum(calls, 9);
+  printf(" total\n");
+}
+
+int main(int argc, char *argv[]) {
+  int hist = 0, pid, r;
+
+  if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+    hist = 1;
+    argc--;
+    argv++;
+  }
+
+  if (argc < 2) {
+    // All harts.
+    for (int cpu = 0; cpu < NCPU; cpu++) {
+      if (getscstat(SCSTAT_CPU, cpu, &cpust) < 0) continue;
+      for (int i = 0; i < NSYSCALL; i++) {
+        st.count[i] += cpust.count[i];
+        st.cycles[i] += cpust.cycles[i];
+        for (int b = 0; b < NSCHIST; b++) st.hist[i][b] += cpust.hist[i][b];
+      }
+    }
+    summary(hist);
+    exit(0);
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    fprintf(2, "strace: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    exec(argv[1], argv + 1);
+    fprintf(2, "strace: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  // The statistics of the child are gone once it is reaped,
+  // so they are copied out as it is.
+  while ((r = waitscstat(0, &st)) != pid) {
+    if (r < 0) {
+      fprintf(2, "strace: waitscstat failed\n");
+      exit(1);
+    }
+  }
+  summary(hist);
+  exit(0);
+}
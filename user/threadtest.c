@@ -0,0 +1,273 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NTHREADS 4
+#define NPAGES 64
+
+void sum_test();
+void fault_test();
+void fd_test();
+void mutex_test();
+void cond_test();
+void timeout_test();
+
+int
+main(int argc, char *argv[])
+{
+  sum_test();
+  fault_test();
+  fd_test();
+  mutex_test();
+  cond_test();
+  timeout_test();
+  printf("threadtest: all tests succeeded\n");
+  exit(0);
+}
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("threadtest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+//
+// threads see each other's writes to global data.
+//
+int data[NTHREADS * 1024];
+int sums[NTHREADS];
+
+void
+sum(void *arg)
+{
+  int t = (int)(uint64)arg;
+  int s = 0;
+
+  for (int i = t; i < NTHREADS * 1024; i += NTHREADS)
+    s += data[i];
+  sums[t] = s;
+}
+
+void
+sum_test()
+{
+  int tids[NTHREADS];
+  int total = 0, expected = 0;
+
+  testname = "sum_test";
+  for (int i = 0; i < NTHREADS * 1024; i++) {
+    data[i] = i;
+    expected += i;
+  }
+  for (int t = 0; t < NTHREADS; t++) {
+    if ((tids[t] = thread_create(sum, (void *)(uint64)t)) < 0)
+      err("thread_create");
+  }
+  for (int t = 0; t < NTHREADS; t++) {
+    if (thread_join(tids[t]) != tids[t])
+      err("thread_join");
+    total += sums[t];
+  }
+  if (total != expected)
+    err("wrong sum");
+  if (join(tids[0]) != -1)
+    err("joined twice");
+  if (wait(0) != -1)
+    err("wait returned a thread");
+
+  printf("sum_test OK\n");
+}
+
+//
+// threads fault the same fresh heap pages in concurrently,
+// and the pages stay shared.
+//
+char *heap;
+
+void
+toucher(void *arg)
+{
+  int t = (int)(uint64)arg;
+
+  for (int i = 0; i < NPAGES; i++)
+    heap[i * PGSIZE + t] = 'a' + t;
+}
+
+void
+fault_test()
+{
+  int tids[NTHREADS];
+
+  testname = "fault_test";
+  if ((heap = sbrk(NPAGES * PGSIZE)) == (char *)-1)
+    err("sbrk");
+  for (int t = 0; t < NTHREADS; t++) {
+    if ((tids[t] = thread_create(toucher, (void *)(uint64)t)) < 0)
+      err("thread_create");
+  }
+  for (int t = 0; t < NTHREADS; t++) {
+    if (thread_join(tids[t]) != tids[t])
+      err("thread_join");
+  }
+  for (int i = 0; i < NPAGES; i++) {
+    for (int t = 0; t < NTHREADS; t++) {
+      if (heap[i * PGSIZE + t] != 'a' + t)
+        err("lost write");
+    }
+  }
+  sbrk(-NPAGES * PGSIZE);
+
+  printf("fault_test OK\n");
+}
+
+//
+// threads share the file descriptor table.
+//
+int fds[2];
+
+void
+opener(void *arg)
+{
+  if (pipe(fds) < 0)
+    err("pipe");
+}
+
+void
+fd_test()
+{
+  int tid;
+  char c;
+
+  testname = "fd_test";
+  if ((tid = thread_create(opener, 0)) < 0)
+    err("thread_create");
+  if (thread_join(tid) != tid)
+    err("thread_join");
+  if (write(fds[1], "x", 1) != 1 || read(fds[0], &c, 1) != 1 || c != 'x')
+    err("pipe of another thread");
+  close(fds[0]);
+  close(fds[1]);
+
+  printf("fd_test OK\n");
+}
+
+//
+// a mutex keeps increments from getting lost.
+//
+struct mutex lock;
+int counter;
+
+void
+incrementer(void *arg)
+{
+  for (int i = 0; i < 1000; i++) {
+    mutex_lock(&lock);
+    counter++;
+    mutex_unlock(&lock);
+  }
+}
+
+void
+mutex_test()
+{
+  int tids[NTHREADS];
+
+  testname = "mutex_test";
+  mutex_init(&lock);
+  counter = 0;
+  for (int t = 0; t < NTHREADS; t++) {
+    if ((tids[t] = thread_create(incrementer, 0)) < 0)
+      err("thread_create");
+  }
+  for (int t = 0; t < NTHREADS; t++) {
+    if (thread_join(tids[t]) != tids[t])
+      err("thread_join");
+  }
+  if (counter != NTHREADS * 1000)
+    err("lost increments");
+
+  printf("mutex_test OK\n");
+}
+
+//
+// a producer hands items to consumers through a condition variable.
+//
+#define NITEMS 200
+struct cond nonempty;
+int items, consumed;
+
+void
+consumer(void *arg)
+{
+  for (;;) {
+    mutex_lock(&lock);
+    while (items == 0 && consumed < NITEMS)
+      cond_wait(&nonempty, &lock);
+    if (items == 0) {
+      mutex_unlock(&lock);
+      break;
+    }
+    items--;
+    if (++consumed == NITEMS)
+      cond_broadcast(&nonempty);
+    mutex_unlock(&lock);
+  }
+}
+
+void
+cond_test()
+{
+  int tids[NTHREADS];
+
+  testname = "cond_test";
+  mutex_init(&lock);
+  cond_init(&nonempty);
+  items = consumed = 0;
+  for (int t = 0; t < NTHREADS; t++) {
+    if ((tids[t] = thread_create(consumer, 0)) < 0)
+      err("thread_create");
+  }
+  for (int i = 0; i < NITEMS; i++) {
+    mutex_lock(&lock);
+    items++;
+    cond_signal(&nonempty);
+    mutex_unlock(&lock);
+  }
+  for (int t = 0; t < NTHREADS; t++) {
+    if (thread_join(tids[t]) != tids[t])
+      err("thread_join");
+  }
+  if (consumed != NITEMS || items != 0)
+    err("lost items");
+
+  printf("cond_test OK\n");
+}
+
+//
+// futex_wait() gives up after its timeout,
+// and does not sleep if the word changed.
+//
+void
+timeout_test()
+{
+  int word = 0;
+  int t0;
+
+  testname = "timeout_test";
+  t0 = uptime();
+  if (futex_wait(&word, 0, 2) != -1)
+    err("no timeout");
+  if (uptime() - t0 < 1)
+    err("woke up too soon");
+  if (futex_wait(&word, 1, 0) != 0)
+    err("slept on a changed word");
+  if (futex_wake(&word, 1) != 0)
+    err("woke up a waiter");
+
+  printf("timeout_test OK\n");
+}
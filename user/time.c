@@ -0,0 +1,40 @@
+#include "kernel/param.h"
+#include "kernel/rusage.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Run a command and report the real, user and system time it took,
+// in ms.
+
+static int ms(uint64 cycles) { return cycles / (MTIME_FREQ / 1000); }
+
+int main(int argc, char *argv[]) {
+  struct rusage ru;
+  int pid, status, start;
+
+  if (argc < 2) {
+    fprintf(2, "usage: time command [args...]\n");
+    exit(1);
+  }
+
+  start = uptime();
+  pid = fork();
+  if (pid < 0) {
+    fprintf(2, "time: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    exec(argv[1], argv + 1);
+    fprintf(2, "time: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  if (wait2(&status, &ru) != pid) {
+    fprintf(2, "time: wait2 failed\n");
+    exit(1);
+  }
+
+  printf("real %dms user %dms sys %dms\n",
+         (uptime() - start) * (1000 * TICK_CYCLES / MTIME_FREQ), ms(ru.utime),
+         ms(ru.stime));
+  exit(status);
+}
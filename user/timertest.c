@@ -0,0 +1,240 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/cpustat.h"
+#include "kernel/rusage.h"
+#include "kernel/vdso.h"
+#include "user/user.h"
+
+#define NSLEEPERS 20
+
+void sleepers_test();
+void nanosleep_test();
+void kill_test();
+void tickless_test();
+void rusage_test();
+void vdso_test();
+
+int
+main(int argc, char *argv[])
+{
+  sleepers_test();
+  nanosleep_test();
+  kill_test();
+  tickless_test();
+  rusage_test();
+  vdso_test();
+  printf("timertest: all tests succeeded\n");
+  exit(0);
+}
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("timertest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+//
+// many processes sleeping at once each wake up
+// after their own time, not sooner and not much later.
+//
+void
+sleepers_test()
+{
+  int n, t0, elapsed, xstatus;
+
+  testname = "sleepers_test";
+  for (int i = 0; i < NSLEEPERS; i++) {
+    int pid = fork();
+    if (pid < 0)
+      err("fork");
+    if (pid == 0) {
+      n = 1 + i % 5;
+      t0 = uptime();
+      if (sleep(n) < 0)
+        exit(1);
+      elapsed = uptime() - t0;
+      exit(elapsed < n - 1 || elapsed > n + 5);
+    }
+  }
+  for (int i = 0; i < NSLEEPERS; i++) {
+    if (wait(&xstatus) < 0)
+      err("wait");
+    if (xstatus != 0)
+      err("woke up at the wrong time");
+  }
+
+  printf("sleepers_test OK\n");
+}
+
+//
+// nanosleep() sleeps for less than a clock tick.
+//
+void
+nanosleep_test()
+{
+  int t0;
+
+  testname = "nanosleep_test";
+  t0 = uptime();
+  // 20 naps of 1ms take far less than a tick of 100ms.
+  for (int i = 0; i < 20; i++) {
+    if (nanosleep(1000000) < 0)
+      err("nanosleep");
+  }
+  if (uptime() - t0 > 2)
+    err("rounded up to clock ticks");
+
+  printf("nanosleep_test OK\n");
+}
+
+//
+// kill() ends a long sleep.
+//
+void
+kill_test()
+{
+  int pid, t0, xstatus;
+
+  testname = "kill_test";
+  pid = fork();
+  if (pid < 0)
+    err("fork");
+  if (pid == 0) {
+    sleep(1000);
+    exit(0);
+  }
+  t0 = uptime();
+  sleep(1);
+  kill(pid);
+  if (wait(&xstatus) != pid)
+    err("wait");
+  if (xstatus != -1)
+    err("not killed");
+  if (uptime() - t0 > 10)
+    err("slept on after kill");
+
+  printf("kill_test OK\n");
+}
+
+//
+// harts with nothing to run don't take clock ticks.
+//
+void
+tickless_test()
+{
+  struct cpustat before, after;
+  int ncpu = 0, nticks = 0;
+
+  testname = "tickless_test";
+  if (getcpuinfo(&before) < 0)
+    err("getcpuinfo");
+  sleep(10);
+  if (getcpuinfo(&after) < 0)
+    err("getcpuinfo");
+  for (int i = 0; i < NCPU; i++) {
+    if (after.online[i]) {
+      ncpu++;
+      nticks += after.ticks[i] - before.ticks[i];
+    }
+  }
+  // a periodic tick would give ncpu * 10.
+  if (nticks > ncpu * 10 / 2)
+    err("idle harts kept ticking");
+
+  printf("tickless_test OK\n");
+}
+
+//
+// wait2() reports the time a child ran in user mode,
+// and none of the time it slept.
+//
+void
+rusage_test()
+{
+  struct rusage ru;
+  volatile int x = 0;
+  int pid, t0, xstatus, real;
+
+  testname = "rusage_test";
+  t0 = uptime();
+  pid = fork();
+  if (pid < 0)
+    err("fork");
+  if (pid == 0) {
+    while (uptime() - t0 < 5) {
+      for (int i = 0; i < 100000; i++)
+        x++;
+    }
+    sleep(5);
+    exit(0);
+  }
+  if (wait2(&xstatus, &ru) != pid)
+    err("wait2");
+  real = uptime() - t0;
+  if (ru.utime < 2 * TICK_CYCLES)
+    err("user time not counted");
+  if (ru.utime + ru.stime > (uint64)(real - 4) * TICK_CYCLES)
+    err("sleep counted as run time");
+
+  printf("rusage_test OK\n");
+}
+
+uint64
+nsec(struct timespec *ts)
+{
+  return ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+//
+// clock_gettime() reads the time page: it agrees with uptime(),
+// never goes backwards, and costs much less than a system call.
+//
+void
+vdso_test()
+{
+  struct timespec a, b;
+  uint64 t0, t1, t2;
+  int ticks, n = 1000;
+
+  testname = "vdso_test";
+  if (clock_gettime(CLOCK_MONOTONIC + 1, &a) >= 0)
+    err("accepted a bad clock");
+  ticks = uptime();
+  if (clock_gettime(CLOCK_MONOTONIC, &a) < 0)
+    err("clock_gettime");
+  t0 = nsec(&a) / (1000000000 / 10);
+  if (t0 < ticks || t0 > ticks + 1)
+    err("disagrees with uptime()");
+
+  for (int i = 0; i < n; i++) {
+    if (clock_gettime(CLOCK_MONOTONIC, &b) < 0)
+      err("clock_gettime");
+    if (nsec(&b) < nsec(&a))
+      err("went backwards");
+    a = b;
+  }
+  sleep(2);
+  clock_gettime(CLOCK_MONOTONIC, &b);
+  if (nsec(&b) - nsec(&a) < 200000000)
+    err("did not see a sleep(2)");
+
+  // Cost per call, against a system call.
+  clock_gettime(CLOCK_MONOTONIC, &a);
+  t0 = nsec(&a);
+  for (int i = 0; i < n; i++)
+    clock_gettime(CLOCK_MONOTONIC, &b);
+  clock_gettime(CLOCK_MONOTONIC, &a);
+  t1 = nsec(&a);
+  for (int i = 0; i < n; i++)
+    uptime();
+  clock_gettime(CLOCK_MONOTONIC, &a);
+  t2 = nsec(&a);
+  printf("clock_gettime %d ns, uptime() %d ns\n", (int)((t1 - t0) / n),
+         (int)((t2 - t1) / n));
+
+  printf("vdso_test OK\n");
+}
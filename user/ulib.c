@@ -1,6 +1,9 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdso.h"
 #include "user/user.h"
 
 char*
@@ -134,3 +137,172 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Threads, on top of clone() and join().
+// thread_create() and thread_join() use malloc(),
+// so only one thread at a time should call them.
+
+#define THREAD_STACK (4*4096)
+#define MAXTHREADS 64
+
+struct thread_start {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static struct {
+  int tid;
+  char *stack;
+} threads[MAXTHREADS];
+
+static void
+thread_start(void *p)
+{
+  struct thread_start *ts = p;
+
+  ts->fn(ts->arg);
+  exit(0);
+}
+
+// Run fn(arg) in a new thread of this process, on a stack of its own.
+// Returns the thread id for thread_join(), or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct thread_start *ts;
+  char *stack;
+  int i, tid;
+
+  for(i = 0; i < MAXTHREADS; i++)
+    if(threads[i].stack == 0)
+      break;
+  if(i == MAXTHREADS || (stack = malloc(THREAD_STACK)) == 0)
+    return -1;
+  // The start arguments sit at the top of the stack, above sp.
+  ts = (struct thread_start*)(stack + THREAD_STACK) - 1;
+  ts->fn = fn;
+  ts->arg = arg;
+  if((tid = clone(thread_start, ts, ts)) < 0){
+    free(stack);
+    return -1;
+  }
+  threads[i].tid = tid;
+  threads[i].stack = stack;
+  return tid;
+}
+
+// Wait for thread tid to finish and free its stack.
+// Returns tid, or -1 if it is not a thread of this process.
+int
+thread_join(int tid)
+{
+  int i;
+
+  if(join(tid) != tid)
+    return -1;
+  for(i = 0; i < MAXTHREADS; i++){
+    if(threads[i].stack && threads[i].tid == tid){
+      free(threads[i].stack);
+      threads[i].stack = 0;
+    }
+  }
+  return tid;
+}
+
+// Mutexes and condition variables, on top of futexes.
+// A mutex is 0 when unlocked, 1 when locked, and 2 when locked
+// and someone may be sleeping on it, so the unlock has to wake it up.
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futex_wait(&m->state, 2, 0);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1){
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    futex_wake(&m->state, 1);
+  }
+}
+
+// A condition variable counts the signals sent, so that a waiter
+// does not go to sleep if one arrives after it released the mutex.
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq, 0);
+  // Others may be waiting for the mutex too: take it in state 2.
+  while(__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0)
+    futex_wait(&m->state, 2, 0);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futex_wake(&c->seq, 0);
+}
+
+// Read the clock clk from the time page (see kernel/vdso.c),
+// without a system call.
+// Returns 0, or -1 if there is no such clock.
+int
+clock_gettime(int clk, struct timespec *ts)
+{
+  struct vdso *vd = (struct vdso*)VDSO;
+  uint seq;
+  uint64 ticks, stamp, d, ns;
+
+  if(clk != CLOCK_MONOTONIC)
+    return -1;
+  do {
+    seq = __atomic_load_n(&vd->seq, __ATOMIC_ACQUIRE);
+    ticks = __atomic_load_n(&vd->ticks, __ATOMIC_RELAXED);
+    stamp = __atomic_load_n(&vd->tickstamp, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while((seq & 1) || __atomic_load_n(&vd->seq, __ATOMIC_RELAXED) != seq);
+
+  // Whole seconds and nanoseconds apart, so that a stale snapshot
+  // does not overflow.
+  d = r_time() - stamp;
+  ns = ticks * (vd->tick_cycles * 1000000000 / vd->freq) +
+       (d % vd->freq) * 1000000000 / vd->freq;
+  ts->tv_sec = d / vd->freq + ns / 1000000000;
+  ts->tv_nsec = ns % 1000000000;
+  return 0;
+}
@@ -0,0 +1,216 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/syscall.h"
+#include "kernel/uring.h"
+#include "kernel/vdso.h"
+#include "user/user.h"
+
+// Tests of the system call rings, and how much they save.
+
+void setup_test();
+void batch_test();
+void link_test();
+void forbidden_test();
+void bench();
+
+struct uring *r;
+
+int
+main(int argc, char *argv[])
+{
+  setup_test();
+  batch_test();
+  link_test();
+  forbidden_test();
+  bench();
+  printf("uringtest: all tests succeeded\n");
+  exit(0);
+}
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("uringtest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// Queue system call num.
+void
+prep(int num, int flags, uint64 a0, uint64 a1, uint64 a2, uint64 data)
+{
+  struct uring_sqe *sqe = &r->sq[r->sq_tail % URING_ENTRIES];
+
+  sqe->num = num;
+  sqe->flags = flags;
+  sqe->args[0] = a0;
+  sqe->args[1] = a1;
+  sqe->args[2] = a2;
+  sqe->user_data = data;
+  __atomic_store_n(&r->sq_tail, r->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+// Take the next completion, which must be there.
+struct uring_cqe
+next()
+{
+  struct uring_cqe cqe;
+
+  if (r->cq_head == __atomic_load_n(&r->cq_tail, __ATOMIC_ACQUIRE))
+    err("missing completion");
+  cqe = r->cq[r->cq_head % URING_ENTRIES];
+  __atomic_store_n(&r->cq_head, r->cq_head + 1, __ATOMIC_RELEASE);
+  return cqe;
+}
+
+uint64
+now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//
+// uring_setup() maps the rings once per address space.
+//
+void
+setup_test()
+{
+  testname = "setup_test";
+  if (uring_enter(1) >= 0)
+    err("entered without rings");
+  if ((r = uring_setup()) == (struct uring*)-1)
+    err("uring_setup");
+  if (uring_setup() != r)
+    err("mapped the rings twice");
+  if (r->sq_head != 0 || r->cq_tail != 0)
+    err("rings not empty");
+  if (uring_enter(1) != 0)
+    err("ran an empty ring");
+
+  printf("setup_test OK\n");
+}
+
+//
+// a batch of writes runs in order, in one call.
+//
+void
+batch_test()
+{
+  char *name = "uringfile", buf[8];
+  struct uring_cqe cqe;
+  int fd;
+
+  testname = "batch_test";
+  if ((fd = open(name, O_CREATE | O_RDWR)) < 0)
+    err("open");
+  for (int i = 0; i < 8; i++)
+    prep(SYS_write, 0, fd, (uint64)"01234567" + i, 1, i);
+  prep(SYS_close, 0, fd, 0, 0, 8);
+  if (uring_enter(9) != 9)
+    err("uring_enter");
+  for (int i = 0; i < 9; i++) {
+    cqe = next();
+    if (cqe.user_data != i || cqe.flags != 0)
+      err("completions out of order");
+    if (cqe.res != (i < 8 ? 1 : 0))
+      err("system call failed");
+  }
+
+  if ((fd = open(name, O_RDONLY)) < 0)
+    err("open");
+  if (read(fd, buf, sizeof(buf)) != 8 || memcmp(buf, "01234567", 8) != 0)
+    err("wrong contents");
+  close(fd);
+  unlink(name);
+
+  printf("batch_test OK\n");
+}
+
+//
+// a failed entry cancels the rest of its chain, and only its chain.
+//
+void
+link_test()
+{
+  struct uring_cqe cqe;
+  char c;
+
+  testname = "link_test";
+  prep(SYS_read, URING_LINK, -1, (uint64)&c, 1, 0);
+  prep(SYS_getpid, URING_LINK, 0, 0, 0, 1);
+  prep(SYS_getpid, 0, 0, 0, 0, 2);
+  prep(SYS_getpid, URING_LINK, 0, 0, 0, 3);
+  prep(SYS_getpid, 0, 0, 0, 0, 4);
+  if (uring_enter(5) != 5)
+    err("uring_enter");
+  cqe = next();
+  if (cqe.res != -1 || cqe.flags != 0)
+    err("read of a bad fd");
+  for (int i = 1; i < 3; i++) {
+    cqe = next();
+    if (cqe.res != -1 || cqe.flags != URING_CANCELED)
+      err("chain not canceled");
+  }
+  for (int i = 3; i < 5; i++) {
+    cqe = next();
+    if (cqe.res != getpid() || cqe.flags != 0)
+      err("next chain canceled");
+  }
+
+  printf("link_test OK\n");
+}
+
+//
+// system calls that replace or end the caller can't be queued.
+//
+void
+forbidden_test()
+{
+  testname = "forbidden_test";
+  prep(SYS_fork, 0, 0, 0, 0, 0);
+  prep(SYS_exit, 0, 0, 0, 0, 0);
+  prep(SYS_uring_enter, 0, 1, 0, 0, 0);
+  if (uring_enter(3) != 3)
+    err("uring_enter");
+  for (int i = 0; i < 3; i++) {
+    if (next().res != -1)
+      err("ran a forbidden system call");
+  }
+
+  printf("forbidden_test OK\n");
+}
+
+//
+// time n fstat() calls made one by one and through the ring.
+//
+void
+bench()
+{
+  struct stat st;
+  uint64 t0, t1, t2;
+  int n = 3200, fd;
+
+  if ((fd = open(".", O_RDONLY)) < 0)
+    err("open");
+  t0 = now();
+  for (int i = 0; i < n; i++)
+    fstat(fd, &st);
+  t1 = now();
+  for (int i = 0; i < n; i += URING_ENTRIES) {
+    for (int j = 0; j < URING_ENTRIES; j++)
+      prep(SYS_fstat, 0, fd, (uint64)&st, 0, j);
+    uring_enter(URING_ENTRIES);
+    for (int j = 0; j < URING_ENTRIES; j++)
+      next();
+  }
+  t2 = now();
+  close(fd);
+  printf("fstat: %d ns each, %d ns through the ring\n",
+         (int)((t1 - t0) / n), (int)((t2 - t1) / n));
+}
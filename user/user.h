@@ -6,6 +6,22 @@
 struct stat;
 struct rtcdate;
 struct pstat;
+struct cpustat;
+struct rusage;
+struct sched_attr;
+struct timespec;
+struct uring;
+struct scstat;
+struct lockstat;
+
+// Locks for threads, see ulib.c.
+struct mutex {
+  int state;
+};
+
+struct cond {
+  int seq;
+};
 
 // system calls
 int fork(void);
@@ -33,6 +49,24 @@ int settickets(int);
 int getpinfo(struct pstat*);
 void *mmap(void *addr, size_t length, int prot, int flags, int fd, int offset);
 int munmap(void *addr, size_t length);
+int schedctl(int, int);
+int getcpuinfo(struct cpustat*);
+int clone(void (*)(void*), void*, void*);
+int join(int);
+int futex_wait(int*, int, int);
+int futex_wake(int*, int);
+int nanosleep(uint64);
+int mkcurrency(int);
+int setcurrency(int);
+int wait2(int*, struct rusage*);
+int sched_setattr(int, struct sched_attr*);
+int sched_setaffinity(int, uint64);
+struct uring *uring_setup(void);
+int uring_enter(int);
+int getscstat(int, int, struct scstat*);
+int profctl(int);
+int getlockstat(struct lockstat*, int);
+int waitscstat(int*, struct scstat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -50,3 +84,13 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int thread_create(void (*)(void*), void*);
+int thread_join(int);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+int clock_gettime(int, struct timespec*);
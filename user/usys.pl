@@ -40,3 +40,21 @@ entry("settickets");
 entry("getpinfo");
 entry("mmap");
 entry("munmap");
+entry("schedctl");
+entry("getcpuinfo");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("nanosleep");
+entry("mkcurrency");
+entry("setcurrency");
+entry("wait2");
+entry("sched_setattr");
+entry("sched_setaffinity");
+entry("uring_setup");
+entry("uring_enter");
+entry("getscstat");
+entry("profctl");
+entry("getlockstat");
+entry("waitscstat");